@@ -15,6 +15,28 @@
  *                        For example, propane monitor is in deep sleep when manager node is rebooted. In this case the manager node will restart with propane tank level of 0 and may not receive
  *                        an update for a long time. This results in tank level of 0 being displayed until an update is received (which could be hours in the case of propane monitor). The persist file
  *                        allows the manager node to load the last known good level reading. 
+ * 2026-10-18 Config schema tables drive parsing, defaults, range checks and derived alarm levels. All config errors are reported in one pass.
+ * 2026-10-18 Manager side aggregates (site, tank type, pump) maintained incrementally as readings arrive.
+ * 2026-10-18 Per tank consumption forecasting (time to empty/low alarm) with refill and leak detection.
+ * 2026-10-18 Sharded ingest: SPSC queues feed per shard workers running the per tank reading pipeline, one thread publishes to tanks[]. Gateway sized tank table.
+ * 2026-10-18 Sensor node simulator/load generator for manager sizing, host build in test/host (make sim).
+ * 2026-10-18 Non-blocking WiFi/alt SSID/MQTT connection state machine with jittered exponential backoff.
+ * 2026-10-18 Asynchronous NTP time service with drift compensation, replaces blocking getNtpTime().
+ * 2026-10-18 Delta state sync: static tank fields are only sent when the manager's config hash does not match.
+ * 2026-10-18 Optional compact tank message encodings (positional JSON, MessagePack) selectable for the data topic.
+ * 2026-10-18 Sonar calibration: temperature compensated speed of sound, multi-point linear fit, full/empty plateau offset suggestions.
+ * 2026-10-18 Alarm notification dispatcher: per sink bounded queues, rate limits, coalescing and priority ordering.
+ * 2026-10-18 Multi-site federation: site managers publish deltas upward, aggregator keeps a bounded (site, tank) index.
+ * 2026-10-18 Dual bank (A/B) config and persist storage with generation counters, CRCs and commit by rename.
+ * 2026-10-18 Adaptive per tank ping interval driven by level rate of change and alarm proximity.
+ * 2026-10-18 Constant tables (alarmsP, config schema, message keys) moved to flash, read through pgmRead()/pgmReadStr().
+ * 2026-10-18 Optional binary event journal (messages, alarm transitions, timeouts) and deterministic replay.
+ * 2026-10-18 Request/response RPC on the control topic (get, history, ping, set thresholds, ack), sensor and manager roles, and per tank level history.
+ * 2026-10-18 Batch kernels for unit conversion, percent full and alarm masks over contiguous arrays.
+ * 2026-10-18 Boot phase profiler with heap low water mark and a single boot report message.
+ * 2026-10-18 Pump runtime/flow accounting from linked tank levels with dry run/blocked pump detection.
+ * 2026-10-18 Memory budget planner, buffers and JSON documents are sized from the loaded config instead of fixed guesses.
+ * 2026-10-18 Host build in test/host: stub Arduino/SPIFFS headers, tests, benchmarks and tools.
  *
  */
 
@@ -23,47 +45,76 @@
 #include <NewPingESP8266.h>
 #include <TimeLib.h>
 #include "timer.h"          // by Michael Contreras
+#include <atomic>
 
 #define TANKSMONCFGFILE  "/tanksmoncfg.json"
 #define TANKSMONPERSISTFILE  "/tanksmonpersist.json"
-#define JSONCONFIGDOCSIZE  4000
-#define JSONPERSISTDOCSIZE  50
 
-byte configBuff[JSONCONFIGDOCSIZE];
+// Buffers and documents are sized from the config at load time, see Memory budget planner. The fixed sizes below are
+// no longer used and only kept so sketches that refer to them still build.
+
+#define JSONCONFIGDOCSIZE  4000    // deprecated, memPlan.configDoc
+#define JSONPERSISTDOCSIZE  50     // deprecated, memPlan.persistDoc
+
+struct memPlanT {
+	size_t configBuff;
+	size_t configDoc;
+	size_t tanks;
+	size_t msgDoc;
+	size_t msgScratch;          // positional encodings, 0 for keyed JSON
+	size_t payload;
+	size_t persistDoc;
+	size_t persistBuff;
+	size_t history;
+	size_t total;
+	uint32_t freeHeap;          // before allocation, 0 if unknown (host build)
+	long headroom;              // free heap left after allocation and reserve
+};
+
+memPlanT memPlan;
+
+byte* configBuff = nullptr;
 File configFile;
-StaticJsonDocument<JSONCONFIGDOCSIZE> configDoc;
+DynamicJsonDocument configDoc(0);
 
-byte presistBuff[JSONPERSISTDOCSIZE];
+byte* presistBuff = nullptr;
 File persistFile;
-StaticJsonDocument<JSONPERSISTDOCSIZE> persistDoc;
+DynamicJsonDocument persistDoc(0);
 
 /*
 Persist Doc Structure
 
-{
 {
 "tanklevels":
 	[
 	{
-	"level":0
-	},
-	{
-	"level":0
-	},
-
-	{
-	"level":0
+	"level":0,
+	"calA":1,
+	"calB":0,
+	"plateauLevel":0,
+	"plateauSince":0,
+	"loAlarmFactor":0.1,
+	"hiAlarmFactor":1.1
 	},
-
 	{
-	"level":0
+	"level":0,
+	"calA":1,
+	"calB":0,
+	"plateauLevel":0,
+	"plateauSince":0
 	}
 	...
 	]
 }
 
+One object per tank in tanks[] order. Only "level" is required, files written before calibration was persisted load
+with calA 1, calB 0 and no plateau in progress. The alarm factors are only present for tanks whose factors were set
+over RPC (see Control topic RPC), they then take the place of the config ones.
+
 */
 
+#define PERSISTTANKKEYS 7   // keys per tank object above, at most
+
 
 
 
@@ -73,6 +124,7 @@ Persist Doc Structure
 
 #define MAXPINGDISTANCE 400
 #define SENDDATADELAY 30000
+#define NODENAMELEN 24        // node names as kept by a manager, longer ones are cut
 
 int numtanks = 0;
 int startingTankNum = -1;
@@ -108,6 +160,8 @@ public:
 	NewPingESP8266* sonar;
 	float loAlarm = 0.10F;  // default to 10%
 	float hiAlarm = 1.10F;  // default to 110%
+	float loAlarmFactor = 0.10F;  // per tank factors, loAlarm/hiAlarm are derived from these at config load
+	float hiAlarmFactor = 1.10F;
 	int pingCount = 0;
 	unsigned long lastMsgTime = 0L;
 	unsigned long timeOut = 60000L;  // default time out value
@@ -115,6 +169,35 @@ public:
 	std::uint8_t alarmFlags_prev = 0b00000000;
 	long int pumpNode = 0;
 	int pumpNumber = 0;
+	long aggVolume = 0;              // volume in 0.1 L units last counted into the manager aggregates
+	std::uint8_t aggFlags = 0;       // alarm flags last counted into the manager aggregates
+	float fcVolume = 0;              // forecast: volume at last forecast sample
+	unsigned long fcTime = 0L;       // forecast: time (seconds) of last forecast sample, 0 = no sample yet
+	float fcRate = 0;                // forecast: smoothed consumption rate in liters/hour, positive = draining
+	std::uint8_t fcFlags = 0;        // forecast: FCREFILL/FCLEAK from the last sample
+	std::uint8_t fcFastCount = 0;    // forecast: consecutive samples draining at leak rate
+	uint32_t cfgHash = 0;            // sync: hash of the static fields, on the manager 0 = not known yet
+	bool syncFull = true;            // sync: sensor side, send static fields with the next message
+	float calA = 1.0F;               // calibration: true depth = calA * measured depth + calB
+	float calB = 0;
+	float calGain = 0;               // calibration: liquid depth = calGain * echo us + calBias, see calTransform()
+	float calBias = 0;
+	float calN = 0, calSx = 0, calSy = 0, calSxx = 0, calSxy = 0;   // calibration: least squares sums
+	float plateauLevel = 0;          // calibration: level the current plateau started at
+	unsigned long plateauSince = 0L; // calibration: time (seconds) the current plateau started
+	float calSuggest = 0;            // calibration: suggested sonarOffset change, valid if calSuggested
+	bool calSuggested = false;
+	long fedVolume = -1;             // federation: volume (0.1 L) last published upstream, -1 = never
+	std::uint8_t fedFlags = 0;       // federation: alarm flags last published upstream
+	long minPingDelay = 0;           // adaptive ping: fastest interval (ms), 0 in config = tankpingdelay
+	long maxPingDelay = 0;           // adaptive ping: slowest interval (ms), 0 in config = tankpingdelay
+	long pingDelay = 0;              // adaptive ping: current interval (ms)
+	unsigned long lastPingTime = 0L; // adaptive ping: millis() of the last reading
+	float lastPingDepth = 0;         // adaptive ping: liquid depth at the last reading
+	bool pingValid = false;          // adaptive ping: lastPingDepth/lastPingTime hold a reading
+	std::uint8_t alarmAck = 0;       // alarm bits acknowledged by an operator, cleared when the alarm clears
+	bool alarmSet = false;           // rpc: alarm factors set over RPC, persisted and kept over the config ones
+	char node[NODENAMELEN] = "";     // rpc: on a manager, the node this tank's readings last came from
 
 	tank()
 	{
@@ -146,7 +229,7 @@ public:
 
 //tank tanks[NUMTANKS];
 
-tank* tanks;
+tank* tanks = nullptr;
 
 
 // ==== End Site Specific Items ====
@@ -157,61 +240,478 @@ tank* tanks;
 //
 
 
-#define MAXPAYLOADSIZE 4000
-#define MAXJSONSIZE 4000
-#define MSGBUFFSIZE 80
+#define MAXPAYLOADSIZE 4000       // deprecated, memPlan.payload
+#define MAXJSONSIZE 4000          // deprecated, memPlan.msgDoc
+#define MSGBUFFSIZE 80            // deprecated, the sketch's MSGBUFFLEN
 
 #define CVTFACTORGALLONS 0.26417F
 #define CVTFACTORINCHES  0.39370F
 
+// Flash resident tables. On the ESP8266 anything not marked PROGMEM, string literals included, is copied to RAM at boot,
+// so the constant tables below live in flash and are read through pgmRead()/pgmReadStr(). On a host build the
+// PROGMEM functions map to the plain ones.
+
+#ifndef ARDUINO
+#define PROGMEM
+#define F(s) (s)
+#define PSTR(s) (s)
+#define memcpy_P memcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#endif
+
+#define CFGKEY(name) const char cfgKey_##name[] PROGMEM = #name;
+#define MSGKEY(name) const char msgKey_##name[] PROGMEM = #name;
+
+template <typename T> T pgmRead(const T& src)
+{
+	T v;
+	memcpy_P(&v, &src, sizeof(T));
+	return(v);
+}
+
+// Copy a flash string to buff, always terminated
+
+char* pgmReadStr(char* buff, const char* src, size_t len)
+{
+	strncpy_P(buff, src, len - 1);
+	buff[len - 1] = 0;
+	return(buff);
+}
+
 // Alarm related bit masks & structs
 
 #define CLEARALARMS   0b00000000
 #define HIALARM       0b00000001
 #define LOALARM       0b00000010
 #define MAXDEPTH      0b00000100
+#define PUMPFAULT     0b00001000     // raised by the manager's pump accounting, not by sensors
 #define NUMALARMS 4
 
-float loAlarmFactor = 0.10;
-float hiAlarmFactor = 1.10;
-
 struct alarm {
 	std::uint8_t alarmType;
 	char alarmName[10];
 };
 
-alarm alarms[NUMALARMS] = {
+const alarm alarmsP[NUMALARMS] PROGMEM = {
   {HIALARM, "HI"},
   {LOALARM, "LO"},
   {MAXDEPTH, "MAXDEPTH"},
   {CLEARALARMS, "CLEARALL"}
 };
 
+std::uint8_t alarmTypeAt(int a)
+{
+	return(pgmRead(alarmsP[a].alarmType));
+}
+
+char* alarmNameAt(int a, char* buff, size_t len)
+{
+	return(pgmReadStr(buff, alarmsP[a].alarmName, len));
+}
+
 bool globalAlarmFlag = false;
 
 // JSON Message Definition
 
-StaticJsonDocument<MAXJSONSIZE> tankmsg;
+DynamicJsonDocument tankmsg(0);   // sized by memPlanAllocate()
+DynamicJsonDocument msgScratch(0);   // positional encodings only, memPlan.msgScratch
+char* payloadBuff = nullptr;      // serialized message buffer, memPlan.payload bytes
+
+#define ENC_JSON     0      // keyed JSON object, as documented below
+#define ENC_JSONPOS  1      // JSON array, values in msgKeys[] order
+#define ENC_MSGPACK  2      // MessagePack array, values in msgKeys[] order
+
+int msgEncData = ENC_JSON;  // tank messages on the data topic, config key mqtt_enc_data. The control topic (commands,
+                            // RPC) is always keyed JSON.
 
 /*  JSON Message Structure
   {
 	"n"         // node name
 	"t"         // tank number
-	"tT"        // tank type
-	"d"         // depth
-	"vCM"       // volume per centimeter
 	"lD"        // liquid depth
 	"lDAvg"      // liquid depth average
 	"lV"        // liquid volume
 	"lvAvg"      // liquid volume average
 	"pF"        // percent full (for propane tank type)
+	"aF"        // alarm flags
+	"cH"        // config hash of the static fields (tT, d, vCM, sO, loA, hiA), these are only present in full messages
+	"tte"       // forecast hours to empty (-1 if not draining), manager only
+	"ttl"       // forecast hours to lo alarm (-1 if not draining), manager only
+	"fF"        // forecast flags (refill/leak), manager only
+	"tT"        // tank type
+	"d"         // depth
+	"vCM"       // volume per centimeter
 	"sO"        // sonar offset
 	"loA"       // lo alarm level
 	"hiA"       // hi alarm level
-	"aF"        // alarm flags
   }
 */
 
+// The keys in the order the positional encodings send them: the fields every message carries first, then the manager's
+// forecast, then the static fields of a full message, so a delta is a short array with no null padding. Only append, or
+// older nodes will be decoded wrongly.
+
+MSGKEY(n)
+MSGKEY(t)
+MSGKEY(lD)
+MSGKEY(lDAvg)
+MSGKEY(lV)
+MSGKEY(lvAvg)
+MSGKEY(pF)
+MSGKEY(aF)
+MSGKEY(cH)
+MSGKEY(tte)
+MSGKEY(ttl)
+MSGKEY(fF)
+MSGKEY(tT)
+MSGKEY(d)
+MSGKEY(vCM)
+MSGKEY(sO)
+MSGKEY(loA)
+MSGKEY(hiA)
+
+const char* const msgKeys[] PROGMEM = {
+	msgKey_n, msgKey_t, msgKey_lD, msgKey_lDAvg, msgKey_lV, msgKey_lvAvg, msgKey_pF, msgKey_aF, msgKey_cH, msgKey_tte, msgKey_ttl, msgKey_fF, msgKey_tT, msgKey_d, msgKey_vCM, msgKey_sO, msgKey_loA, msgKey_hiA
+};
+
+#define NUMMSGKEYS (sizeof(msgKeys) / sizeof(msgKeys[0]))
+
+
+//
+// Forward Declarations
+//
+
+void calTransform(int t);
+void jrnAlarm(int t, std::uint8_t alarmType, bool raised, unsigned long ms);
+size_t memPlanConfigDoc(const byte* json, size_t len);
+bool memPlanAllocate();
+bool syncApply(JsonDocument& doc, tank& tk);
+bool msgDecode(const char* in, size_t len, JsonDocument& doc, JsonDocument& scratch);
+void alarmCheck(int t, unsigned long nowMs);
+void pumpOnReading(int t, unsigned long ts);
+std::uint8_t pumpFaultFlags(int t);
+void histAdd(int t, uint32_t ts);
+void jrnMsg(int t, unsigned long ms);
+void jrnTimeout(int t, unsigned long ms);
+void rpcOnReading(int t);
+
+//
+// Config schema
+//
+// Each entry describes one config file key: where it goes, its type, whether it must be present, its default and its valid range.
+// loadConfig() walks these tables once, applying defaults for missing optional keys and collecting every error before giving up,
+// so a bad config file reports all of its problems in one boot instead of one per site visit.
+//
+
+#define MAXTANKS 32
+#define MAXCFGERRORS 16
+
+#define CFG_INT    0
+#define CFG_LONG   1
+#define CFG_ULONG  2
+#define CFG_UINT32 3
+#define CFG_FLOAT  4
+#define CFG_BOOL   5
+#define CFG_STR    6
+
+#define CFGERR_MISSING  1
+#define CFGERR_TYPE     2
+#define CFGERR_RANGE    3
+
+const char cfgErrMissing[] PROGMEM = "missing";
+const char cfgErrType[] PROGMEM = "wrong type";
+const char cfgErrRange[] PROGMEM = "out of range";
+
+const char* const cfgErrNames[] PROGMEM = { cfgErrMissing, cfgErrType, cfgErrRange };   // CFGERR_MISSING - 1 ...
+
+struct cfgField {
+	const char* key;     // flash string
+	std::uint8_t type;
+	bool required;
+	double defVal;       // ignored for CFG_STR, strings keep their compiled in default when missing
+	double minVal;       // double so integer limits up to 2^31 - 1 are exact
+	double maxVal;
+	void* dest;          // site fields: address of the global
+	size_t offset;       // tank fields: offset into class tank
+};
+
+struct cfgError {
+	int tank;            // -1 for site fields
+	const char* key;     // flash string
+	std::uint8_t code;
+};
+
+cfgError cfgErrors[MAXCFGERRORS];
+int numCfgErrors = 0;
+
+// Config key names
+
+CFGKEY(numtanks)
+CFGKEY(startingTankNum)
+CFGKEY(sitename)
+CFGKEY(pssid)
+CFGKEY(ppwd)
+CFGKEY(usealtssid)
+CFGKEY(altssid)
+CFGKEY(altpwd)
+CFGKEY(timezone)
+CFGKEY(dst)
+CFGKEY(mqtt_topic_data)
+CFGKEY(mqtt_topic_ctrl)
+CFGKEY(mqtt_uid)
+CFGKEY(mqtt_pwd)
+CFGKEY(otapwd)
+CFGKEY(imperial)
+CFGKEY(useavg)
+CFGKEY(debug)
+CFGKEY(tankpingdelay)
+CFGKEY(blynkauthtoken)
+CFGKEY(mqtt_enc_data)
+CFGKEY(tankType)
+CFGKEY(ignore)
+CFGKEY(timeout)
+CFGKEY(depth)
+CFGKEY(vCM)
+CFGKEY(sensorOffset)
+CFGKEY(sonarTrigPin)
+CFGKEY(sonarEchoPin)
+CFGKEY(loAlarmFactor)
+CFGKEY(hiAlarmFactor)
+CFGKEY(pumpnode)
+CFGKEY(pumpnumber)
+CFGKEY(minpingdelay)
+CFGKEY(maxpingdelay)
+CFGKEY(tankdefs)
+
+// Site fields. numtanks is listed first as the tank array is sized from it.
+
+const cfgField siteSchema[] PROGMEM = {
+	{cfgKey_numtanks,         CFG_INT,   true,  0,     1,      MAXTANKS,   &numtanks,        0},
+	{cfgKey_startingTankNum,  CFG_INT,   true,  0,     0,      1000,       &startingTankNum, 0},
+	{cfgKey_sitename,         CFG_STR,   true,  0,     0,      0,          &sitename,        0},
+	{cfgKey_pssid,            CFG_STR,   true,  0,     0,      0,          &pssid,           0},
+	{cfgKey_ppwd,             CFG_STR,   false, 0,     0,      0,          &ppwd,            0},
+	{cfgKey_usealtssid,       CFG_BOOL,  false, 0,     0,      1,          &wifiTryAlt,      0},
+	{cfgKey_altssid,          CFG_STR,   false, 0,     0,      0,          &assid,           0},
+	{cfgKey_altpwd,           CFG_STR,   false, 0,     0,      0,          &apwd,            0},
+	{cfgKey_timezone,         CFG_INT,   false, 0,     -12,    14,         &timeZone,        0},
+	{cfgKey_dst,              CFG_BOOL,  false, 0,     0,      1,          &dst,             0},
+	{cfgKey_mqtt_topic_data,  CFG_STR,   true,  0,     0,      0,          &mqttTopicData,   0},
+	{cfgKey_mqtt_topic_ctrl,  CFG_STR,   false, 0,     0,      0,          &mqttTopicCtrl,   0},
+	{cfgKey_mqtt_uid,         CFG_STR,   false, 0,     0,      0,          &mqttUid,         0},
+	{cfgKey_mqtt_pwd,         CFG_STR,   false, 0,     0,      0,          &mqttPwd,         0},
+	{cfgKey_otapwd,           CFG_STR,   false, 0,     0,      0,          &otaPwd,          0},
+	{cfgKey_imperial,         CFG_BOOL,  false, 0,     0,      1,          &imperial,        0},
+	{cfgKey_useavg,           CFG_BOOL,  false, 0,     0,      1,          &useAvg,          0},
+	{cfgKey_debug,            CFG_BOOL,  false, 0,     0,      1,          &debug,           0},
+	{cfgKey_tankpingdelay,    CFG_LONG,  false, 5000,  100,    86400000.0, &tankpingdelay,   0},
+	{cfgKey_blynkauthtoken,   CFG_STR,   false, 0,     0,      0,          &blynkAuth,       0},
+	{cfgKey_mqtt_enc_data,    CFG_INT,   false, 0,     0,      2,          &msgEncData,      0}
+};
+
+#define NUMSITEFIELDS (sizeof(siteSchema) / sizeof(siteSchema[0]))
+
+// Tank fields, one set per entry of "tankdefs"
+
+const cfgField tankSchema[] PROGMEM = {
+	{cfgKey_tankType,       CFG_STR,    false, 0,     0,    0,               nullptr, offsetof(tank, tankType)},
+	{cfgKey_ignore,         CFG_BOOL,   false, 0,     0,    1,               nullptr, offsetof(tank, ignore)},
+	{cfgKey_timeout,        CFG_ULONG,  false, 60,    1,    604800,          nullptr, offsetof(tank, timeOut)},
+	{cfgKey_depth,          CFG_FLOAT,  true,  0,     1,    MAXPINGDISTANCE, nullptr, offsetof(tank, depth)},
+	{cfgKey_vCM,            CFG_FLOAT,  true,  0,     0.01, 100000,          nullptr, offsetof(tank, vCM)},
+	{cfgKey_sensorOffset,   CFG_INT,    false, 0,     0,    MAXPINGDISTANCE, nullptr, offsetof(tank, sonarOffset)},
+	{cfgKey_sonarTrigPin,   CFG_UINT32, false, 0,     0,    16,              nullptr, offsetof(tank, sonarTrigPin)},
+	{cfgKey_sonarEchoPin,   CFG_UINT32, false, 0,     0,    16,              nullptr, offsetof(tank, sonarEchoPin)},
+	{cfgKey_loAlarmFactor,  CFG_FLOAT,  false, 0.10,  0,    2,               nullptr, offsetof(tank, loAlarmFactor)},
+	{cfgKey_hiAlarmFactor,  CFG_FLOAT,  false, 1.10,  0,    2,               nullptr, offsetof(tank, hiAlarmFactor)},
+	{cfgKey_pumpnode,       CFG_LONG,   false, 0,     0,    2147483647.0,    nullptr, offsetof(tank, pumpNode)},
+	{cfgKey_pumpnumber,     CFG_INT,    false, 0,     0,    255,             nullptr, offsetof(tank, pumpNumber)},
+	{cfgKey_minpingdelay,   CFG_LONG,   false, 0,     0,    86400000.0,      nullptr, offsetof(tank, minPingDelay)},
+	{cfgKey_maxpingdelay,   CFG_LONG,   false, 0,     0,    86400000.0,      nullptr, offsetof(tank, maxPingDelay)}
+};
+
+#define NUMTANKFIELDS (sizeof(tankSchema) / sizeof(tankSchema[0]))
+
+// Build report: RAM kept free by holding the constant tables in flash
+
+size_t flashTablesSize()
+{
+	size_t n = sizeof(alarmsP) + sizeof(siteSchema) + sizeof(tankSchema) + sizeof(msgKeys) + sizeof(cfgErrNames);
+
+	for (size_t f = 0; f < NUMSITEFIELDS; f++) n += strlen_P(pgmRead(siteSchema[f].key)) + 1;
+	for (size_t f = 0; f < NUMTANKFIELDS; f++) n += strlen_P(pgmRead(tankSchema[f].key)) + 1;
+	for (size_t k = 0; k < NUMMSGKEYS; k++) n += strlen_P(pgmRead(msgKeys[k])) + 1;
+	for (size_t e = 0; e < sizeof(cfgErrNames) / sizeof(cfgErrNames[0]); e++) n += strlen_P(pgmRead(cfgErrNames[e])) + 1;
+	return(n);
+}
+
+void dumpFlashTables()
+{
+	msgn = snprintf(msgbuff, MSGBUFFLEN, "\nFlash tables: %u bytes kept out of RAM", (unsigned)flashTablesSize());
+	outputMsg(msgbuff);
+}
+
+
+void cfgAddError(int t, const char* key, std::uint8_t code)
+{
+	if (numCfgErrors < MAXCFGERRORS)
+	{
+		cfgErrors[numCfgErrors].tank = t;
+		cfgErrors[numCfgErrors].key = key;
+		cfgErrors[numCfgErrors].code = code;
+	}
+	numCfgErrors++;   // keep counting past the table so the report shows how many were dropped
+}
+
+//
+// Parse one field from obj into dest. Missing optional fields get the schema default, anything else that is wrong is recorded
+// and the destination is still set to the default so the rest of the load sees sane values.
+//
+
+void cfgParseField(JsonVariant obj, const cfgField& field, void* dest, int t)
+{
+	cfgField f = pgmRead(field);
+	char key[24];
+	JsonVariant v = obj[pgmReadStr(key, f.key, sizeof(key))];
+	float val = f.defVal;
+	long lval = (long)f.defVal;
+	bool isInt = (f.type == CFG_INT || f.type == CFG_LONG || f.type == CFG_ULONG || f.type == CFG_UINT32);
+
+	if (v.isNull())
+	{
+		if (f.required) cfgAddError(t, f.key, CFGERR_MISSING);
+		if (f.type == CFG_STR) return;
+	}
+	else if (f.type == CFG_STR)
+	{
+		if (!v.is<const char*>())
+		{
+			cfgAddError(t, f.key, CFGERR_TYPE);
+			return;
+		}
+		*(const char**)dest = v.as<const char*>();
+		return;
+	}
+	else if (f.type == CFG_BOOL)
+	{
+		if (v.is<bool>()) val = v.as<bool>() ? 1 : 0;
+		else if (v.is<long>() && (v.as<long>() == 0 || v.as<long>() == 1)) val = v.as<long>();   // older config files use 0/1
+		else cfgAddError(t, f.key, v.is<float>() ? CFGERR_RANGE : CFGERR_TYPE);
+	}
+	else if (isInt)
+	{
+		// Integers never go through float, which only holds 24 bits of mantissa
+		if (v.is<long>())
+		{
+			lval = v.as<long>();
+			if (!((double)lval >= f.minVal && (double)lval <= f.maxVal))
+			{
+				cfgAddError(t, f.key, CFGERR_RANGE);
+				lval = (long)f.defVal;
+			}
+		}
+		else if (v.is<float>() && !(v.as<double>() >= f.minVal && v.as<double>() <= f.maxVal))
+		{
+			cfgAddError(t, f.key, CFGERR_RANGE);   // whole number too big for a long
+		}
+		else
+		{
+			cfgAddError(t, f.key, CFGERR_TYPE);
+		}
+	}
+	else if (!v.is<float>())
+	{
+		cfgAddError(t, f.key, CFGERR_TYPE);
+	}
+	else
+	{
+		val = v.as<float>();
+		if (!(val >= f.minVal && val <= f.maxVal))   // also catches NaN
+		{
+			cfgAddError(t, f.key, CFGERR_RANGE);
+			val = f.defVal;
+		}
+	}
+
+	switch (f.type) {
+	case CFG_INT:
+		*(int*)dest = (int)lval;
+		break;
+	case CFG_LONG:
+		*(long*)dest = lval;
+		break;
+	case CFG_ULONG:
+		*(unsigned long*)dest = (unsigned long)lval;
+		break;
+	case CFG_UINT32:
+		*(uint32_t*)dest = (uint32_t)lval;
+		break;
+	case CFG_FLOAT:
+		*(float*)dest = val;
+		break;
+	case CFG_BOOL:
+		*(bool*)dest = (val != 0);
+		break;
+	}
+}
+
+//
+// String fields point into configBuff. The first call saves the compiled in defaults, later calls put them back so a
+// reload never keeps a pointer into the previous buffer when the new file leaves a string out.
+//
+
+void cfgResetSiteStrings()
+{
+	static const char* defaults[NUMSITEFIELDS];
+	static bool saved = false;
+
+	for (size_t f = 0; f < NUMSITEFIELDS; f++)
+	{
+		if (pgmRead(siteSchema[f].type) != CFG_STR) continue;
+		const char** dest = (const char**)pgmRead(siteSchema[f].dest);
+		if (saved) *dest = defaults[f];
+		else defaults[f] = *dest;
+	}
+	saved = true;
+}
+
+//
+// Derived fields, computed once here so nothing downstream has to redo the math per reading
+//
+
+void cfgDeriveTank(int t)
+{
+	tanks[t].timeOut *= 1000;   // timeout is stored in config file in seconds, convert to milliseconds
+	tanks[t].loAlarm = tanks[t].loAlarmFactor * tanks[t].depth;
+	tanks[t].hiAlarm = tanks[t].hiAlarmFactor * tanks[t].depth;
+	if (tanks[t].loAlarm >= tanks[t].hiAlarm) cfgAddError(t, cfgKey_loAlarmFactor, CFGERR_RANGE);
+	if (tanks[t].minPingDelay == 0) tanks[t].minPingDelay = tankpingdelay;
+	if (tanks[t].maxPingDelay == 0) tanks[t].maxPingDelay = tankpingdelay;
+	if (tanks[t].minPingDelay > tanks[t].maxPingDelay) cfgAddError(t, cfgKey_minpingdelay, CFGERR_RANGE);
+	tanks[t].pingDelay = tanks[t].minPingDelay;
+	calTransform(t);
+}
+
+void dumpCfgErrors()
+{
+	int n = (numCfgErrors < MAXCFGERRORS) ? numCfgErrors : MAXCFGERRORS;
+
+	msgn = snprintf(msgbuff, MSGBUFFLEN, "\nConfig file has %i error(s):", numCfgErrors);
+	outputMsg(msgbuff);
+	for (int e = 0; e < n; e++)
+	{
+		char key[24];
+		char err[16];
+		pgmReadStr(key, cfgErrors[e].key, sizeof(key));
+		pgmReadStr(err, pgmRead(cfgErrNames[cfgErrors[e].code - 1]), sizeof(err));
+		if (cfgErrors[e].tank < 0) msgn = snprintf(msgbuff, MSGBUFFLEN, "\nsite.%s %s", key, err);
+		else msgn = snprintf(msgbuff, MSGBUFFLEN, "\ntankdefs[%i].%s %s", cfgErrors[e].tank, key, err);
+		outputMsg(msgbuff);
+	}
+	if (numCfgErrors > n) outputMsg("\n(further errors not listed)");
+}
+
 
 //
 // Functions
@@ -253,40 +753,388 @@ bool openPersistFile()
 }
 
 
-bool loadConfig()
+//
+// Boot profiler
+//
+// bootMark() closes the current boot phase: it records the time since the previous mark and the free heap at that
+// point. loadConfig() marks its own phases (mount, config read, parse, dump, tanks); the sketch adds its own after it
+// (sonar setup, WiFi, ...) and sends bootReportMsg() once when setup() ends. Phase names are flash strings (PSTR).
+// On a host build the heap figures are 0, unless TANKSMON_HOSTHEAP names a function returning a modelled free heap.
+//
+
+#define BOOTMAXPHASES 12
+
+struct bootPhase {
+	const char* name;        // flash string
+	uint32_t us;
+	uint32_t freeHeap;
+};
+
+bootPhase bootPhases[BOOTMAXPHASES];
+int numBootPhases = 0;
+unsigned long bootLastMark = 0L;
+uint32_t bootMinHeap = 0xFFFFFFFFUL;
+
+uint32_t bootFreeHeap()
 {
-	DeserializationError jsonError;
-	size_t size = 0;
-	int t = 0;
+#ifdef ARDUINO
+	return(ESP.getFreeHeap());
+#elif defined(TANKSMON_HOSTHEAP)
+	return(TANKSMON_HOSTHEAP());
+#else
+	return(0);
+#endif
+}
 
-	Serial.println("Mounting FS...");
-	if (!SPIFFS.begin())
+void bootMark(const char* name)
+{
+	unsigned long now = micros();
+	uint32_t heap = bootFreeHeap();
+
+	if (heap < bootMinHeap) bootMinHeap = heap;
+	if (numBootPhases < BOOTMAXPHASES)
 	{
-		Serial.println("Failed to mount file system");
-		return false;
+		bootPhases[numBootPhases].name = name;
+		bootPhases[numBootPhases].us = now - bootLastMark;   // first phase runs from reset
+		bootPhases[numBootPhases].freeHeap = heap;
+		numBootPhases++;
 	}
-	else Serial.println("Mounted file system");
+	bootLastMark = now;
+}
 
-	Serial.print("\nOpening config file: ");
-	Serial.print(TANKSMONCFGFILE);
-	configFile = SPIFFS.open(TANKSMONCFGFILE, "r");
-	if (!configFile)
+/*  JSON Boot Report Structure
+  {
+	"n"         // node name
+	"b"         // [[phase name, ms, free heap], ...]
+	"tot"       // total ms
+	"minH"      // lowest free heap seen at a mark
+  }
+*/
+
+void bootReportMsg(JsonDocument& doc, const char* node)
+{
+	JsonObject root = doc.to<JsonObject>();
+	JsonArray b;
+	uint32_t total = 0;
+	char name[16];
+
+	root["n"] = node;
+	b = root.createNestedArray("b");
+	for (int i = 0; i < numBootPhases; i++)
 	{
-		Serial.println("Failed to open config file");
-		if (!SPIFFS.exists(TANKSMONCFGFILE)) Serial.println("File does not exist");
-		return false;
+		JsonArray e = b.createNestedArray();
+		e.add(pgmReadStr(name, bootPhases[i].name, sizeof(name)));
+		e.add(bootPhases[i].us / 1000.0F);
+		e.add(bootPhases[i].freeHeap);
+		total += bootPhases[i].us;
+	}
+	root["tot"] = total / 1000.0F;
+	root["minH"] = bootMinHeap;
+}
+
+//
+// Dual bank storage
+//
+// Config and persist data are kept in two bank files (<base>.a and <base>.b), each a bankHeader followed by the body.
+// bankSave() writes the new body to <base>.t, then replaces a bank by rename. The bank replaced is never the newest
+// one that passes its CRC check, so a power loss at any point, or a previous save that left a torn bank behind, still
+// leaves the last good data on flash. bankLoad() checks both headers (magic, length against file size) without parsing
+// anything, then takes the highest generation whose CRC matches and falls back to the other bank if it does not.
+// bankReport records what happened for the boot log.
+//
+
+#define TANKSMONCFGBANK      "/tanksmoncfg"
+#define TANKSMONPERSISTBANK  "/tanksmonpst"
+#define BANKMAGIC            0x544D4231UL   // "TMB1"
+#define BANKCHUNK            64             // bytes read at a time when checking a file without loading it
+
+struct bankHeader {
+	uint32_t magic;
+	uint32_t generation;
+	uint32_t length;
+	uint32_t crc;
+};
+
+struct bankReportT {
+	char bank;               // 'A', 'B', or 0 if none was valid
+	uint32_t generation;
+	uint32_t crc;            // of the body loaded
+	bool fellBack;           // newest bank was bad, older one used
+	bool validA;             // header and CRC good (only checked until a good bank is found)
+	bool validB;
+};
+
+bankReportT bankReport;
+
+// CRC-32 of data, continuing from crc (the result of a previous call) so a file can be checked a chunk at a time
+
+uint32_t crc32(const byte* data, size_t len, uint32_t crc = 0)
+{
+	crc = ~crc;
+	while (len--)
+	{
+		crc ^= *data++;
+		for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));   // bitwise, no table in RAM
+	}
+	return(~crc);
+}
+
+// CRC of len bytes of f from its current position, read BANKCHUNK at a time. False if the file ends early.
+
+bool crc32File(File& f, size_t len, uint32_t& crc)
+{
+	byte chunk[BANKCHUNK];
+
+	crc = 0;
+	while (len > 0)
+	{
+		size_t n = len < BANKCHUNK ? len : BANKCHUNK;
+		if (f.read(chunk, n) != n) return(false);
+		crc = crc32(chunk, n, crc);
+		len -= n;
+	}
+	return(true);
+}
+
+void bankPath(char* path, size_t len, const char* base, char suffix)
+{
+	snprintf(path, len, "%s.%c", base, suffix);
+}
+
+// Read and sanity check a bank header, returns false if missing or inconsistent
+
+bool bankReadHeader(const char* path, bankHeader& hdr, size_t maxLen)
+{
+	File f = SPIFFS.open(path, "r");
+	bool ok;
+
+	if (!f) return(false);
+	ok = f.read((byte*)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == BANKMAGIC && hdr.length <= maxLen && f.size() == sizeof(hdr) + hdr.length;
+	f.close();
+	return(ok);
+}
+
+bool bankReadBody(const char* path, const bankHeader& hdr, byte* buff)
+{
+	File f = SPIFFS.open(path, "r");
+	bool ok;
+
+	if (!f) return(false);
+	ok = f.seek(sizeof(hdr)) && f.read(buff, hdr.length) == hdr.length && crc32(buff, hdr.length) == hdr.crc;
+	f.close();
+	return(ok);
+}
+
+// Header and CRC check of a bank without a buffer for its body
+
+bool bankValid(const char* path, bankHeader& hdr)
+{
+	File f = SPIFFS.open(path, "r");
+	uint32_t crc;
+	bool ok;
+
+	if (!f) return(false);
+	ok = f.read((byte*)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == BANKMAGIC && f.size() == sizeof(hdr) + hdr.length &&
+		crc32File(f, hdr.length, crc) && crc == hdr.crc;
+	f.close();
+	return(ok);
+}
+
+// Largest body length of the two banks (0 if neither header is good), for sizing the load buffer
+
+size_t bankMaxLen(const char* base)
+{
+	char path[32];
+	bankHeader hdr;
+	size_t len = 0;
+
+	bankPath(path, sizeof(path), base, 'a');
+	if (bankReadHeader(path, hdr, 0xFFFFFFFFUL)) len = hdr.length;
+	bankPath(path, sizeof(path), base, 'b');
+	if (bankReadHeader(path, hdr, 0xFFFFFFFFUL) && hdr.length > len) len = hdr.length;
+	return(len);
+}
+
+// Load the newest good bank of base into buff, leaving out bank skip ('A' or 'B') if given, e.g. because its contents
+// were rejected. Returns the body length, 0 if no bank is usable.
+
+size_t bankLoad(const char* base, byte* buff, size_t buffLen, char skip = 0)
+{
+	char pathA[32], pathB[32];
+	bankHeader hA, hB;
+	bool hdrA, hdrB;
+	bool aFirst;
+
+	bankPath(pathA, sizeof(pathA), base, 'a');
+	bankPath(pathB, sizeof(pathB), base, 'b');
+	hdrA = skip != 'A' && bankReadHeader(pathA, hA, buffLen);
+	hdrB = skip != 'B' && bankReadHeader(pathB, hB, buffLen);
+	aFirst = hdrA && (!hdrB || hA.generation > hB.generation);
+
+	bankReport = bankReportT();
+	for (int pass = 0; pass < 2; pass++)
+	{
+		bool useA = (pass == 0) == aFirst;
+		if (!(useA ? hdrA : hdrB) || !bankReadBody(useA ? pathA : pathB, useA ? hA : hB, buff)) continue;
+		if (useA) bankReport.validA = true;
+		else bankReport.validB = true;
+		bankReport.bank = useA ? 'A' : 'B';
+		bankReport.generation = useA ? hA.generation : hB.generation;
+		bankReport.crc = useA ? hA.crc : hB.crc;
+		bankReport.fellBack = (pass == 1) || skip != 0;
+		return(useA ? hA.length : hB.length);
+	}
+	return(0);
+}
+
+// Write a new generation of base: header for len bytes with the given CRC, then body() writes the bytes. The bank
+// replaced is the older one if both pass their CRC check, otherwise the one that does not; the generation is one above
+// any header still readable so the new bank is always taken first.
+
+bool bankWrite(const char* base, size_t len, uint32_t crc, std::function<bool(File&)> body)
+{
+	char pathA[32], pathB[32], pathT[32];
+	bankHeader hA, hB, hdr;
+	bool validA, validB;
+	const char* target;
+	File f;
+
+	bankPath(pathA, sizeof(pathA), base, 'a');
+	bankPath(pathB, sizeof(pathB), base, 'b');
+	bankPath(pathT, sizeof(pathT), base, 't');
+	validA = bankValid(pathA, hA);
+	validB = bankValid(pathB, hB);
+	if (validA && validB) target = hA.generation > hB.generation ? pathB : pathA;
+	else target = validA ? pathB : pathA;
+
+	hdr.magic = BANKMAGIC;
+	hdr.generation = 0;
+	if (bankReadHeader(pathA, hA, 0xFFFFFFFFUL)) hdr.generation = hA.generation;
+	if (bankReadHeader(pathB, hB, 0xFFFFFFFFUL) && hB.generation > hdr.generation) hdr.generation = hB.generation;
+	hdr.generation++;
+	hdr.length = len;
+	hdr.crc = crc;
+
+	f = SPIFFS.open(pathT, "w");
+	if (!f) return(false);
+	if (f.write((const byte*)&hdr, sizeof(hdr)) != sizeof(hdr) || !body(f))
+	{
+		f.close();
+		SPIFFS.remove(pathT);
+		return(false);
+	}
+	f.close();
+
+	SPIFFS.remove(target);
+	return(SPIFFS.rename(pathT, target));
+}
+
+bool bankSave(const char* base, const byte* body, size_t len)
+{
+	return(bankWrite(base, len, crc32(body, len), [body, len](File& f) { return(f.write(body, len) == len); }));
+}
+
+// Copy a plain file into the banks, a chunk at a time
+
+bool bankSaveFile(const char* base, const char* path)
+{
+	File src = SPIFFS.open(path, "r");
+	size_t len;
+	uint32_t crc;
+	bool ok;
+
+	if (!src) return(false);
+	len = src.size();
+	ok = crc32File(src, len, crc) && src.seek(0) && bankWrite(base, len, crc, [&src, len](File& f) {
+		byte chunk[BANKCHUNK];
+		for (size_t left = len, n; left > 0; left -= n)
+		{
+			n = left < BANKCHUNK ? left : BANKCHUNK;
+			if (src.read(chunk, n) != n || f.write(chunk, n) != n) return(false);
+		}
+		return(true);
+	});
+	src.close();
+	return(ok);
+}
+
+void dumpBankReport(const char* what)
+{
+	if (bankReport.bank == 0) msgn = snprintf(msgbuff, MSGBUFFLEN, "\n%s: no valid bank", what);
+	else msgn = snprintf(msgbuff, MSGBUFFLEN, "\n%s: bank %c gen %u%s", what, bankReport.bank, (unsigned)bankReport.generation, bankReport.fellBack ? " (fallback)" : "");
+	outputMsg(msgbuff);
+}
+
+// Last known levels and sonar calibration, see Persist Doc Structure. Written through the banks instead of rewriting one file in place.
+
+bool savePersist()
+{
+	size_t len;
+
+	persistDoc.clear();
+	JsonArray levels = persistDoc.createNestedArray("tanklevels");
+	for (int t = 0; t < numtanks; t++)
+	{
+		JsonObject lvl = levels.createNestedObject();
+		lvl["level"] = tanks[t].liquidDepth;
+		lvl["calA"] = tanks[t].calA;
+		lvl["calB"] = tanks[t].calB;
+		lvl["plateauLevel"] = tanks[t].plateauLevel;
+		lvl["plateauSince"] = tanks[t].plateauSince;
+		if (tanks[t].alarmSet)
+		{
+			lvl["loAlarmFactor"] = tanks[t].loAlarmFactor;
+			lvl["hiAlarmFactor"] = tanks[t].hiAlarmFactor;
+		}
+	}
+	if (persistDoc.overflowed()) return(false);
+
+	len = serializeJson(persistDoc, (char*)presistBuff, memPlan.persistBuff);
+	return(len > 0 && len < memPlan.persistBuff && bankSave(TANKSMONPERSISTBANK, presistBuff, len));
+}
+
+bool loadPersist()
+{
+	size_t len = bankLoad(TANKSMONPERSISTBANK, presistBuff, memPlan.persistBuff);
+
+	dumpBankReport("Persist");
+	if (len == 0 || deserializeJson(persistDoc, (char*)presistBuff, len)) return(false);   // in place, keys are not copied
+
+	JsonArray levels = persistDoc["tanklevels"];
+	for (int t = 0; t < numtanks && t < (int)levels.size(); t++)
+	{
+		JsonObject lvl = levels[t];
+		tanks[t].liquidDepth = lvl["level"] | 0.0F;
+		tanks[t].calA = lvl["calA"] | 1.0F;
+		tanks[t].calB = lvl["calB"] | 0.0F;
+		tanks[t].plateauLevel = lvl["plateauLevel"] | 0.0F;
+		tanks[t].plateauSince = lvl["plateauSince"] | 0UL;
+		calTransform(t);
+		if (lvl.containsKey("loAlarmFactor") && lvl.containsKey("hiAlarmFactor"))
+		{
+			tanks[t].loAlarmFactor = lvl["loAlarmFactor"];
+			tanks[t].hiAlarmFactor = lvl["hiAlarmFactor"];
+			tanks[t].loAlarm = tanks[t].loAlarmFactor * tanks[t].depth;
+			tanks[t].hiAlarm = tanks[t].hiAlarmFactor * tanks[t].depth;
+			tanks[t].alarmSet = true;
+		}
 	}
+	return(true);
+}
 
-	size = configFile.size();
-	Serial.print("File size = ");
-	Serial.println(size);
 
-	configFile.read(configBuff, size);
+// Parse size bytes of config JSON in buff (in place, configDoc keeps pointers into it), validate it and set up the
+// site globals, tanks[] and the planned buffers. Nothing from buff is kept if it returns false.
 
-	jsonError = deserializeJson(configDoc, configBuff);
+bool cfgApply(byte* buff, size_t size)
+{
+	DeserializationError jsonError;
+
+	configDoc = DynamicJsonDocument(memPlanConfigDoc(buff, size));
+	jsonError = deserializeJson(configDoc, (char*)buff, size);
 	if (jsonError)
 	{
-		Serial.println("Failed to parse config file");
+		Serial.println(F("Failed to parse config file"));
 		switch (jsonError.code()) {
 		case DeserializationError::Ok:
 			Serial.print(F("Deserialization succeeded"));
@@ -303,73 +1151,120 @@ bool loadConfig()
 		}
 		return false;
 	}
-	Serial.println("\nPretty dump of config file: \n");
-	size_t uartsz = 128;
-	serializeJsonPretty(configDoc, msgbuff, MSGBUFFSIZE);
-	outputMsg(msgbuff);
+	bootMark(PSTR("cfgparse"));
+	Serial.println(F("\nPretty dump of config file: \n"));
+	serializeJsonPretty(configDoc, Serial);   // streamed, the whole dump without a buffer for it
+	bootMark(PSTR("cfgdump"));
 
-	sitename = configDoc["site"]["sitename"];
-	pssid = configDoc["site"]["pssid"];
-	timeZone = configDoc["site"]["timezone"];
-	dst = configDoc["site"]["dst"];
-	ppwd = configDoc["site"]["ppwd"];
-	wifiTryAlt = configDoc["site"]["usealtssid"];
-	assid = configDoc["site"]["altssid"];
-	apwd = configDoc["site"]["altpwd"];
-	mqttTopicData = configDoc["site"]["mqtt_topic_data"];
-	mqttTopicCtrl = configDoc["site"]["mqtt_topic_ctrl"];
-	mqttUid = configDoc["site"]["mqtt_uid"];
-	mqttPwd = configDoc["site"]["mqtt_pwd"];
-	otaPwd = configDoc["site"]["otapwd"];
-
-	numtanks = configDoc["site"]["numtanks"];
-	tanks = new tank[numtanks];
-
-	startingTankNum = configDoc["site"]["startingTankNum"];
+	numCfgErrors = 0;
+	cfgResetSiteStrings();
+	for (size_t f = 0; f < NUMSITEFIELDS; f++) cfgParseField(configDoc["site"], siteSchema[f], pgmRead(siteSchema[f].dest), -1);
 
-	//displayUpdateDelay = configDoc["site"]["displaydelay"];
-	imperial = configDoc["site"]["imperial"];
-	useAvg = configDoc["site"]["useavg"];
-	debug = configDoc["site"]["debug"];
-	tankpingdelay = configDoc["site"]["tankpingdelay"];
-	// senddatadelay = configDoc["site"]["senddatadelay"];
-	otaPwd = configDoc["site"]["otapwd"];
-	blynkAuth = configDoc["site"]["blynkauthtoken"];
+	if (configDoc["tankdefs"].size() < (size_t)numtanks)
+	{
+		cfgAddError(-1, cfgKey_tankdefs, CFGERR_MISSING);
+		numtanks = configDoc["tankdefs"].size();
+	}
+	delete[] tanks;
+	tanks = new tank[numtanks];
 
 	for (int t = 0; t < numtanks; t++)
 	{
-		tanks[t].tankType = configDoc["tankdefs"][t]["tankType"];
-		tanks[t].ignore = configDoc["tankdefs"][t]["ignore"];
-		tanks[t].timeOut = configDoc["tankdefs"][t]["timeout"];
-		tanks[t].timeOut *= 1000;   // timeout is stored in config file in seconds, convert to milliseconds
-		tanks[t].depth = configDoc["tankdefs"][t]["depth"];
-		tanks[t].vCM = configDoc["tankdefs"][t]["vCM"];
-
-		tanks[t].sonarOffset = configDoc["tankdefs"][t]["sensorOffset"];
-
-		tanks[t].sonarTrigPin = configDoc["tankdefs"][t]["sonarTrigPin"];
-		tanks[t].sonarEchoPin = configDoc["tankdefs"][t]["sonarEchoPin"];
-
-		loAlarmFactor = configDoc["tankdefs"][t]["loAlarmFactor"];
-		tanks[t].loAlarm = loAlarmFactor * tanks[t].depth;
-		hiAlarmFactor = configDoc["tankdefs"][t]["hiAlarmFactor"];
-		tanks[t].hiAlarm = hiAlarmFactor * tanks[t].depth;
-		tanks[t].pumpNode = configDoc["tankdefs"][t]["pumpnode"];
-		tanks[t].pumpNumber = configDoc["tankdefs"][t]["pumpnumber"];
+		for (size_t f = 0; f < NUMTANKFIELDS; f++) cfgParseField(configDoc["tankdefs"][t], tankSchema[f], (byte*)&tanks[t] + pgmRead(tankSchema[f].offset), t);
+		cfgDeriveTank(t);
+	}
 
+	if (numCfgErrors > 0)
+	{
+		dumpCfgErrors();
+		return false;
 	}
 
-	Serial.println("Config loaded");
+	if (!memPlanAllocate()) return false;
+
+	bootMark(PSTR("tanks"));
+	Serial.println(F("Config loaded"));
 	if (debug) dumpTanksStruct();
 
 	return true;
 }
 
+// The plain config file is what gets uploaded; the banks hold the last config that loaded. A config file that is new or
+// differs from the bank (by CRC) is tried first and only written to a bank once it has parsed and validated. Otherwise,
+// or if it is rejected, the newest bank is used, then the other one.
 
-int mapAlarm(std::uint8_t alarmType)
+bool loadConfig()
 {
-	switch (alarmType) {
-	case HIALARM:
+	size_t size = 0;
+	size_t bankSize;
+	size_t fileSize = 0;
+	uint32_t fileCrc = 0;
+	bool haveFile;
+
+	Serial.println(F("Mounting FS..."));
+	if (!SPIFFS.begin())
+	{
+		Serial.println(F("Failed to mount file system"));
+		return false;
+	}
+	else Serial.println(F("Mounted file system"));
+	bootMark(PSTR("mount"));
+
+	configFile = SPIFFS.open(TANKSMONCFGFILE, "r");
+	haveFile = (bool)configFile;
+	if (haveFile)
+	{
+		fileSize = configFile.size();
+		haveFile = crc32File(configFile, fileSize, fileCrc) && configFile.seek(0);
+	}
+
+	bankSize = bankMaxLen(TANKSMONCFGBANK);
+	delete[] configBuff;
+	configBuff = new byte[(bankSize > fileSize ? bankSize : fileSize) + 1];
+	size = bankLoad(TANKSMONCFGBANK, configBuff, bankSize);
+	dumpBankReport("Config");
+
+	if (haveFile && (size == 0 || fileCrc != bankReport.crc))
+	{
+		Serial.print(F("\nConfig file changed: "));
+		Serial.print(TANKSMONCFGFILE);
+		Serial.print(F(" size = "));
+		Serial.println(fileSize);
+		haveFile = configFile.read(configBuff, fileSize) == fileSize;
+		configFile.close();
+		bootMark(PSTR("cfgread"));
+		if (haveFile && cfgApply(configBuff, fileSize))
+		{
+			if (!bankSaveFile(TANKSMONCFGBANK, TANKSMONCFGFILE)) Serial.println(F("Failed to save config bank"));
+			return true;
+		}
+		Serial.println(F("Config file rejected, trying the banks"));
+		size = bankLoad(TANKSMONCFGBANK, configBuff, bankSize);   // parsed in place, reload
+	}
+	else
+	{
+		if (configFile) configFile.close();
+		bootMark(PSTR("cfgread"));
+	}
+
+	if (size == 0)
+	{
+		Serial.println(F("No usable config bank"));
+		if (!SPIFFS.exists(TANKSMONCFGFILE)) Serial.println(F("Config file does not exist"));
+		return false;
+	}
+	if (cfgApply(configBuff, size)) return true;
+
+	size = bankLoad(TANKSMONCFGBANK, configBuff, bankSize, bankReport.bank);
+	dumpBankReport("Config");
+	return(size > 0 && cfgApply(configBuff, size));
+}
+
+
+int mapAlarm(std::uint8_t alarmType)
+{
+	switch (alarmType) {
+	case HIALARM:
 		return (0);
 
 	case LOALARM:
@@ -386,4 +1281,2629 @@ int mapAlarm(std::uint8_t alarmType)
 	}
 }
 
+// HI/LO/MAXDEPTH flags for a liquid level (cm) against the tank's alarm levels
+
+std::uint8_t alarmLevelFlags(const tank& tk, float level)
+{
+	std::uint8_t flags = CLEARALARMS;
+
+	if (level >= tk.hiAlarm) flags |= HIALARM;
+	if (level <= tk.loAlarm) flags |= LOALARM;
+	if (level >= tk.depth) flags |= MAXDEPTH;
+	return(flags);
+}
+
+
+
+
+//
+// Manager aggregates
+//
+// Running totals by site, tank type and pump. Each tank remembers what it last contributed (aggVolume/aggFlags) so an update
+// only applies the difference. Volumes are kept as integer tenths of a liter so repeated add/subtract does not drift.
+// Call aggInit() after loadConfig() and aggUpdate(t) whenever tanks[t] gets a new reading or new alarm flags.
+// Tanks whose type or pump finds no free bucket still count in the site total and are tallied in aggTypeOverflow/
+// aggPumpOverflow, which the summary message reports.
+//
+
+#define MAXTANKTYPES 4
+#define MAXPUMPS 8
+#define NUMALARMBITS 3     // HI, LO, MAXDEPTH
+
+struct aggBucket {
+	long volume = 0;       // 0.1 L
+	long capacity = 0;     // 0.1 L, depth * vCM of the member tanks
+	int numTanks = 0;
+	int alarmCount[NUMALARMBITS] = { 0, 0, 0 };
+	char tankType = 0;     // type buckets only
+	long pumpNode = 0;     // pump buckets only
+	int pumpNumber = 0;
+};
+
+aggBucket aggSiteTotal;
+aggBucket aggTypes[MAXTANKTYPES];
+aggBucket aggPumps[MAXPUMPS];
+int numAggTypes = 0;
+int numAggPumps = 0;
+int aggTypeOverflow = 0;   // tanks left out of the type buckets, more than MAXTANKTYPES types
+int aggPumpOverflow = 0;   // tanks left out of the pump buckets, more than MAXPUMPS pumps
+
+aggBucket* aggFindType(char tankType, bool add)
+{
+	for (int i = 0; i < numAggTypes; i++)
+		if (aggTypes[i].tankType == tankType) return(&aggTypes[i]);
+
+	if (!add || numAggTypes >= MAXTANKTYPES) return(nullptr);
+	aggTypes[numAggTypes].tankType = tankType;
+	return(&aggTypes[numAggTypes++]);
+}
+
+aggBucket* aggFindPump(long pumpNode, int pumpNumber, bool add)
+{
+	if (pumpNode == 0) return(nullptr);   // tank not linked to a pump
+
+	for (int i = 0; i < numAggPumps; i++)
+		if (aggPumps[i].pumpNode == pumpNode && aggPumps[i].pumpNumber == pumpNumber) return(&aggPumps[i]);
+
+	if (!add || numAggPumps >= MAXPUMPS) return(nullptr);
+	aggPumps[numAggPumps].pumpNode = pumpNode;
+	aggPumps[numAggPumps].pumpNumber = pumpNumber;
+	return(&aggPumps[numAggPumps++]);
+}
+
+void aggApply(aggBucket* b, long dVolume, std::uint8_t oldFlags, std::uint8_t newFlags)
+{
+	if (b == nullptr) return;
+
+	b->volume += dVolume;
+	for (int a = 0; a < NUMALARMBITS; a++)
+	{
+		std::uint8_t mask = alarmTypeAt(a);
+		b->alarmCount[a] += ((newFlags & mask) ? 1 : 0) - ((oldFlags & mask) ? 1 : 0);
+	}
+}
+
+void aggUpdate(int t)
+{
+	if (tanks[t].ignore) return;
+
+	long volume = (long)((useAvg ? tanks[t].liquidVolumeAvg : tanks[t].liquidVolume) * 10.0F);
+	long dVolume = volume - tanks[t].aggVolume;
+	std::uint8_t oldFlags = tanks[t].aggFlags;
+	std::uint8_t newFlags = tanks[t].alarmFlags;
+
+	if (dVolume == 0 && oldFlags == newFlags) return;
+
+	aggApply(&aggSiteTotal, dVolume, oldFlags, newFlags);
+	aggApply(aggFindType(tanks[t].tankType[0], false), dVolume, oldFlags, newFlags);
+	aggApply(aggFindPump(tanks[t].pumpNode, tanks[t].pumpNumber, false), dVolume, oldFlags, newFlags);
+
+	tanks[t].aggVolume = volume;
+	tanks[t].aggFlags = newFlags;
+}
+
+// Count tanks[t] into its buckets. aggInit() does this for every configured tank; a gateway calls it for a tank first
+// seen at run time (see Sharded manager ingest).
+
+void aggAddTank(int t)
+{
+	long capacity = (long)(tanks[t].depth * tanks[t].vCM * 10.0F);
+	aggBucket* bt = aggFindType(tanks[t].tankType[0], true);
+	aggBucket* bp = aggFindPump(tanks[t].pumpNode, tanks[t].pumpNumber, true);
+
+	tanks[t].aggVolume = 0;
+	tanks[t].aggFlags = 0;
+	if (tanks[t].ignore) return;
+
+	aggSiteTotal.numTanks++;
+	aggSiteTotal.capacity += capacity;
+	if (bt != nullptr)
+	{
+		bt->numTanks++;
+		bt->capacity += capacity;
+	}
+	else aggTypeOverflow++;
+	if (bp != nullptr)
+	{
+		bp->numTanks++;
+		bp->capacity += capacity;
+	}
+	else if (tanks[t].pumpNode != 0) aggPumpOverflow++;
+	aggUpdate(t);
+}
+
+void aggInit()
+{
+	aggSiteTotal = aggBucket();
+	for (int i = 0; i < MAXTANKTYPES; i++) aggTypes[i] = aggBucket();
+	for (int i = 0; i < MAXPUMPS; i++) aggPumps[i] = aggBucket();
+	numAggTypes = 0;
+	numAggPumps = 0;
+	aggTypeOverflow = 0;
+	aggPumpOverflow = 0;
+
+	for (int t = 0; t < numtanks; t++) aggAddTank(t);
+}
+
+//
+// Queries. Volumes come back in display units (liters or gallons per the imperial flag).
+//
+
+float aggVolume(const aggBucket* b)
+{
+	if (b == nullptr) return(0);
+	return(b->volume * (imperial ? CVTFACTORGALLONS / 10.0F : 0.1F));
+}
+
+float aggPercentFull(const aggBucket* b)
+{
+	if (b == nullptr || b->capacity == 0) return(0);
+	return(b->volume * 100.0F / b->capacity);
+}
+
+int aggAlarmCount(const aggBucket* b, std::uint8_t alarmType)
+{
+	int a = mapAlarm(alarmType);
+
+	if (b == nullptr || a < 0 || a >= NUMALARMBITS) return(0);
+	return(b->alarmCount[a]);
+}
+
+/*  JSON Summary Message Structure
+  {
+	"n"         // site name
+	"nT"        // number of monitored tanks
+	"V"         // site total volume
+	"pF"        // site percent full
+	"aC"        // [HI, LO, MAXDEPTH] alarm counts
+	"ty"        // [{ "tT", "V", "pF", "aC" }, ...] per tank type
+	"pu"        // [{ "pN", "pn", "V", "pF", "aC" }, ...] per pump
+	"ov"        // [type, pump] tanks left out of the buckets above, only sent when non zero
+  }
+*/
+
+void aggBucketMsg(JsonObject obj, const aggBucket* b)
+{
+	obj["V"] = aggVolume(b);
+	obj["pF"] = aggPercentFull(b);
+	JsonArray aC = obj.createNestedArray("aC");
+	for (int a = 0; a < NUMALARMBITS; a++) aC.add(b->alarmCount[a]);
+}
+
+void aggSummaryMsg(JsonDocument& doc)
+{
+	JsonObject root = doc.to<JsonObject>();   // clears doc
+
+	root["n"] = sitename;
+	root["nT"] = aggSiteTotal.numTanks;
+	aggBucketMsg(root, &aggSiteTotal);
+
+	JsonArray ty = root.createNestedArray("ty");
+	for (int i = 0; i < numAggTypes; i++)
+	{
+		JsonObject o = ty.createNestedObject();
+		char tT[2] = { aggTypes[i].tankType, 0 };
+		o["tT"] = tT;
+		aggBucketMsg(o, &aggTypes[i]);
+	}
+
+	JsonArray pu = root.createNestedArray("pu");
+	for (int i = 0; i < numAggPumps; i++)
+	{
+		JsonObject o = pu.createNestedObject();
+		o["pN"] = aggPumps[i].pumpNode;
+		o["pn"] = aggPumps[i].pumpNumber;
+		aggBucketMsg(o, &aggPumps[i]);
+	}
+
+	if (aggTypeOverflow || aggPumpOverflow)
+	{
+		JsonArray ov = root.createNestedArray("ov");
+		ov.add(aggTypeOverflow);
+		ov.add(aggPumpOverflow);
+	}
+}
+
+
+//
+// Consumption forecasting
+//
+// An exponentially weighted consumption rate per tank, updated once per reading with O(1) state kept in class tank.
+// Samples that rise by more than FCREFILLFRAC of capacity are treated as refills and samples that drain more than FCLEAKFACTOR
+// times the usual rate are flagged as leaks. Refills and short leak spikes are not folded into the rate so one event does
+// not skew the forecast; a fast drain that lasts FCLEAKSAMPLES samples is real consumption (or a real leak) and the rate
+// follows it, still flagged until the rate has caught up.
+// Times are in seconds (e.g. now()) so the forecast survives a sensor node deep sleeping between readings.
+//
+
+#define FCALPHA        0.2F     // weight of the newest sample in the smoothed rate
+#define FCMININTERVAL  60       // seconds, readings closer together than this are skipped
+#define FCREFILLFRAC   0.02F    // rise of 2% of capacity between samples = refill
+#define FCLEAKFACTOR   4.0F     // drain faster than 4x the smoothed rate = leak
+#define FCLEAKMINFRAC  0.01F    // ...but only if also faster than 1% of capacity per hour
+#define FCLEAKSAMPLES  3        // fast drain for this many samples in a row is folded into the rate
+
+#define FCREFILL 0b00000001
+#define FCLEAK   0b00000010
+
+void fcUpdate(tank& tk, unsigned long ts)
+{
+	float volume = useAvg ? tk.liquidVolumeAvg : tk.liquidVolume;
+	float capacity = tk.depth * tk.vCM;
+
+	if (tk.fcTime == 0 || ts < tk.fcTime)   // first sample or clock went backwards, restart
+	{
+		tk.fcVolume = volume;
+		tk.fcTime = ts;
+		tk.fcFlags = 0;
+		tk.fcFastCount = 0;
+		return;
+	}
+	if (ts - tk.fcTime < FCMININTERVAL) return;
+
+	float hours = (ts - tk.fcTime) / 3600.0F;
+	float rate = (tk.fcVolume - volume) / hours;
+
+	tk.fcFlags = 0;
+	if (volume - tk.fcVolume > FCREFILLFRAC * capacity)
+	{
+		tk.fcFlags |= FCREFILL;
+		tk.fcFastCount = 0;
+	}
+	else
+	{
+		if (tk.fcRate > 0 && rate > FCLEAKFACTOR * tk.fcRate && rate > FCLEAKMINFRAC * capacity)
+		{
+			tk.fcFlags |= FCLEAK;
+			if (tk.fcFastCount < 255) tk.fcFastCount++;
+		}
+		else tk.fcFastCount = 0;
+		if (tk.fcFastCount == 0 || tk.fcFastCount >= FCLEAKSAMPLES) tk.fcRate += FCALPHA * (rate - tk.fcRate);
+	}
+
+	tk.fcVolume = volume;
+	tk.fcTime = ts;
+}
+
+void fcUpdate(int t, unsigned long ts)
+{
+	fcUpdate(tanks[t], ts);
+}
+
+// Hours until the tank reaches the given level (cm), -1 if it is not draining
+
+float fcHoursToLevel(int t, float level)
+{
+	float volume = (tanks[t].fcVolume - level * tanks[t].vCM);
+
+	if (tanks[t].fcRate <= 0) return(-1);
+	if (volume <= 0) return(0);
+	return(volume / tanks[t].fcRate);
+}
+
+float fcTimeToEmpty(int t)
+{
+	return(fcHoursToLevel(t, 0));
+}
+
+float fcTimeToLow(int t)
+{
+	return(fcHoursToLevel(t, tanks[t].loAlarm));
+}
+
+void fcMsg(JsonDocument& doc, int t)
+{
+	doc["tte"] = fcTimeToEmpty(t);
+	doc["ttl"] = fcTimeToLow(t);
+	doc["fF"] = tanks[t].fcFlags;
+}
+
+
+//
+// Sharded manager ingest
+//
+// For managers on multi-core gateways. Tanks are split across NUMSHARDS shards by tank index (tank numbers are unique
+// across the nodes of a site, so the index already identifies the (node, tank) pair); a worker thread per shard
+// keeps its own copy of its tanks and runs the per tank part of the reading pipeline on it: decode, sync apply, alarm
+// flags re-derived from the level, forecast and timeouts. Results go back to the thread that owns tanks[] (loop()),
+// where shardCollect() publishes them into tanks[] and runs the stages shared between tanks: aggregates, alarm
+// dispatch, pump accounting, history, journal and RPC. Only that thread writes tanks[], so nothing else needs a lock.
+//
+// The network thread hands the raw message to shardPush(), which only peeks at the tank number to pick the shard.
+// Each shard has two single producer/single consumer lock free queues (messages in, events out); a worker that finds
+// its out queue full stops draining, so a slow collect throttles ingest instead of losing readings.
+// On a single core node call shardDrain() and shardCheckTimeouts() for every shard, then shardCollect(), from loop().
+//
+// The tank table is the registry. A manager configured for its site uses tanks[] as loaded; a gateway calls
+// shardInit() with the number of tank slots it should hold, the slots past the config start unknown (depth 0) and are
+// filled in from the first full message of that tank number, tank type included. The shards themselves are allocated
+// by the first shardInit(), so a manager that never shards does not carry their queues.
+//
+
+#ifndef NUMSHARDS
+#define NUMSHARDS 4
+#endif
+#ifndef SHARDQUEUESIZE
+#ifdef ARDUINO
+#define SHARDQUEUESIZE 4     // messages (and events) per shard, must be a power of 2
+#else
+#define SHARDQUEUESIZE 32
+#endif
+#endif
+#ifndef SHARDMSGSIZE
+#define SHARDMSGSIZE 256     // largest encoded tank message accepted
+#endif
+#define SHARDDOCSIZE  (JSON_OBJECT_SIZE(24) + 256)   // decoded tank message, keys and strings copied
+#define SHARDNODELEN  NODENAMELEN
+
+#define SHARDEV_READING  1
+#define SHARDEV_TIMEOUT  2
+#define SHARDEV_PULL     3   // static fields of an unknown tank needed, nothing else to publish
+
+struct shardMsg {
+	unsigned long msgTime;   // millis() when received
+	uint32_t ts;             // seconds (now()) when received, for the forecast and history
+	uint16_t len;
+	char payload[SHARDMSGSIZE];
+};
+
+struct shardEvent {
+	std::uint8_t type;
+	bool added;              // first full message for a gateway slot, count it into the aggregates
+	bool pull;               // static fields changed, ask the node for a full message
+	int t;
+	unsigned long msgTime;
+	uint32_t ts;
+	char node[SHARDNODELEN];
+	tank state;              // the shard's copy after the reading
+};
+
+// Single producer/single consumer ring, slots allocated by shardInit()
+
+template <typename T> struct shardQueue {
+	T* slots = nullptr;
+	alignas(64) std::atomic<uint32_t> head{ 0 };   // next slot to read, written by the consumer only
+	alignas(64) std::atomic<uint32_t> tail{ 0 };   // next slot to write, written by the producer only
+
+	// producer: a free slot to fill, nullptr if full; push() makes it visible
+	T* claim()
+	{
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) >= SHARDQUEUESIZE) return(nullptr);
+		return(&slots[t & (SHARDQUEUESIZE - 1)]);
+	}
+	void push() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	// consumer: the oldest entry, nullptr if empty; pop() releases it
+	T* front()
+	{
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return(nullptr);
+		return(&slots[h & (SHARDQUEUESIZE - 1)]);
+	}
+	void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+};
+
+struct tankShard {
+	shardQueue<shardMsg> in;
+	shardQueue<shardEvent> out;
+	shardQueue<int> resync;         // tanks whose static fields the owner of tanks[] no longer trusts, see shardResync()
+	tank* own = nullptr;            // worker copy, own[k] is tanks[s + k * NUMSHARDS]
+	bool* timedOut = nullptr;
+	int numOwn = 0;
+	DynamicJsonDocument doc{ 0 };   // decode buffers, worker only
+	DynamicJsonDocument scratch{ 0 };
+	unsigned long dropped = 0;      // producer side: queue full, message too long or no tank number
+	unsigned long rejected = 0;     // worker side: undecodable or tank number outside the table
+	std::atomic<bool> alarmFlag{ false };   // written by the worker, any owned tank in alarm
+	std::atomic<int> timedOutCount{ 0 };    // written by the worker, owned tanks past their timeOut
+};
+
+tankShard* shards = nullptr;   // NUMSHARDS, allocated by shardInit()
+std::function<void(const char*, int)> shardPullHook;   // (node, tank number): publish syncPullMsg() on the control topic
+std::function<void(int)> shardReadingHook;            // tank index, after a reading has been published to tanks[]
+
+int shardOf(int t)
+{
+	return(t % NUMSHARDS);
+}
+
+// Set up the shards after loadConfig(). A gateway passes the number of tank slots to hold (tank numbers
+// startingTankNum .. startingTankNum + maxTanks - 1); tanks[] and everything sized from numtanks grow to match.
+// Not thread safe, call before the workers start.
+
+bool shardInit(int maxTanks)
+{
+	if (maxTanks > numtanks)
+	{
+		tank* grown = new tank[maxTanks];
+		for (int t = 0; t < numtanks; t++) grown[t] = tanks[t];
+		for (int t = numtanks; t < maxTanks; t++)
+		{
+			grown[t].ignore = true;   // unknown until its first full message
+			grown[t].depth = 0;
+		}
+		delete[] tanks;
+		tanks = grown;
+		numtanks = maxTanks;
+		if (!memPlanAllocate()) return(false);
+	}
+
+	if (shards == nullptr) shards = new tankShard[NUMSHARDS];
+	for (int s = 0; s < NUMSHARDS; s++)
+	{
+		tankShard& sh = shards[s];
+		delete[] sh.in.slots;
+		delete[] sh.out.slots;
+		delete[] sh.resync.slots;
+		delete[] sh.own;
+		delete[] sh.timedOut;
+		sh.in.slots = new shardMsg[SHARDQUEUESIZE];
+		sh.out.slots = new shardEvent[SHARDQUEUESIZE];
+		sh.resync.slots = new int[SHARDQUEUESIZE];
+		sh.in.head = sh.in.tail = 0;
+		sh.out.head = sh.out.tail = 0;
+		sh.resync.head = sh.resync.tail = 0;
+		sh.numOwn = (numtanks - s + NUMSHARDS - 1) / NUMSHARDS;
+		sh.own = new tank[sh.numOwn > 0 ? sh.numOwn : 1];
+		sh.timedOut = new bool[sh.numOwn > 0 ? sh.numOwn : 1]();
+		for (int k = 0; k < sh.numOwn; k++) sh.own[k] = tanks[s + k * NUMSHARDS];
+		sh.doc = DynamicJsonDocument(SHARDDOCSIZE);
+		sh.scratch = DynamicJsonDocument(SHARDDOCSIZE);
+		sh.dropped = sh.rejected = 0;
+		sh.alarmFlag = false;
+		sh.timedOutCount = 0;
+	}
+	return(true);
+}
+
+// Tank number of an encoded tank message without decoding it: "t" in keyed JSON, the second element of positional
+// JSON or MessagePack (see msgKeys[]). -1 if not found.
+
+long shardPeekTank(const char* in, size_t len)
+{
+	const byte* b = (const byte*)in;
+	size_t i = 1;
+
+	if (len < 2) return(-1);
+	if (in[0] == '{' || in[0] == '[')
+	{
+		if (in[0] == '{')
+		{
+			for (i = 1; i + 4 < len; i++)
+				if (in[i] == '"' && in[i + 1] == 't' && in[i + 2] == '"' && in[i + 3] == ':') break;
+			i += 4;
+		}
+		else
+		{
+			if (in[i] == '"')   // skip the node name
+			{
+				for (i++; i < len && in[i] != '"'; i++)
+					if (in[i] == '\\') i++;
+				i++;
+			}
+			else if (i + 4 <= len && strncmp(in + i, "null", 4) == 0) i += 4;
+			if (i >= len || in[i] != ',') return(-1);
+			i++;
+		}
+		if (i >= len || !(in[i] == '-' || (in[i] >= '0' && in[i] <= '9'))) return(-1);
+
+		char num[12];
+		size_t n = 0;
+		while (i < len && n < sizeof(num) - 1 && (in[i] == '-' || (in[i] >= '0' && in[i] <= '9'))) num[n++] = in[i++];
+		num[n] = 0;
+		return(strtol(num, nullptr, 10));
+	}
+
+	// MessagePack: fixarray/array16 header, node as fixstr/str8/nil, then an integer
+	if ((b[0] & 0xF0) == 0x90) i = 1;
+	else if (b[0] == 0xDC) i = 3;
+	else return(-1);
+	if (i >= len) return(-1);
+	if ((b[i] & 0xE0) == 0xA0) i += 1 + (b[i] & 0x1F);
+	else if (b[i] == 0xD9 && i + 1 < len) i += 2 + b[i + 1];
+	else if (b[i] == 0xC0) i++;
+	else return(-1);
+	if (i >= len) return(-1);
+	if (b[i] < 0x80) return(b[i]);
+	if (b[i] >= 0xE0) return((int8_t)b[i]);
+	if (b[i] == 0xCC && i + 1 < len) return(b[i + 1]);
+	if (b[i] == 0xCD && i + 2 < len) return((b[i + 1] << 8) | b[i + 2]);
+	if (b[i] == 0xD0 && i + 1 < len) return((int8_t)b[i + 1]);
+	if (b[i] == 0xD1 && i + 2 < len) return((int16_t)((b[i + 1] << 8) | b[i + 2]));
+	return(-1);
+}
+
+// Producer (network thread). Returns false and counts a drop if the message cannot be routed or the shard is full.
+
+bool shardPush(const char* payload, size_t len, unsigned long msgTime, uint32_t ts)
+{
+	long t = shardPeekTank(payload, len) - startingTankNum;
+	tankShard& sh = shards[t >= 0 ? shardOf(t) : 0];
+	shardMsg* m = (t >= 0 && t < numtanks && len <= SHARDMSGSIZE) ? sh.in.claim() : nullptr;
+
+	if (m == nullptr)
+	{
+		sh.dropped++;
+		return(false);
+	}
+	m->msgTime = msgTime;
+	m->ts = ts;
+	m->len = len;
+	memcpy(m->payload, payload, len);
+	sh.in.push();
+	return(true);
+}
+
+// Consumer (shard worker). Runs the per tank stages for queued messages, returns the number handled.
+
+int shardDrain(int s)
+{
+	tankShard& sh = shards[s];
+	shardMsg* m;
+	int* r;
+	int n = 0;
+
+	while ((r = sh.resync.front()) != nullptr)
+	{
+		sh.own[*r / NUMSHARDS].cfgHash = 0;   // the next delta pulls a full message
+		sh.resync.pop();
+	}
+
+	while ((m = sh.in.front()) != nullptr)
+	{
+		shardEvent* ev = sh.out.claim();
+		if (ev == nullptr) break;   // collect is behind, leave the rest queued
+
+		int t = -1;
+		if (msgDecode(m->payload, m->len, sh.doc, sh.scratch)) t = (sh.doc["t"] | -1) - startingTankNum;
+		if (t < 0 || t >= numtanks || shardOf(t) != s)
+		{
+			sh.rejected++;
+			sh.in.pop();
+			continue;
+		}
+
+		tank& tk = sh.own[t / NUMSHARDS];
+		const char* node = sh.doc["n"] | "";
+		strncpy(ev->node, node, SHARDNODELEN - 1);
+		ev->node[SHARDNODELEN - 1] = 0;
+		ev->t = t;
+		ev->msgTime = m->msgTime;
+		ev->ts = m->ts;
+		ev->added = false;
+		ev->pull = false;
+
+		if (tk.depth == 0)   // gateway slot, nothing known about this tank yet
+		{
+			if (!sh.doc.containsKey("d"))
+			{
+				ev->type = SHARDEV_PULL;
+				sh.out.push();
+				sh.in.pop();
+				n++;
+				continue;
+			}
+			tk.ignore = false;
+			ev->added = true;
+		}
+
+		ev->pull = syncApply(sh.doc, tk);
+		tk.alarmFlags = alarmLevelFlags(tk, useAvg ? tk.liquidDepthAvg : tk.liquidDepth);
+		tk.lastMsgTime = m->msgTime;
+		fcUpdate(tk, m->ts);
+		sh.timedOut[t / NUMSHARDS] = false;
+
+		ev->type = SHARDEV_READING;
+		ev->state = tk;
+		sh.out.push();
+		sh.in.pop();
+		n++;
+	}
+
+	if (n > 0)
+	{
+		bool alarmFlag = false;
+		for (int k = 0; k < sh.numOwn; k++)
+			if (!sh.own[k].ignore && sh.own[k].alarmFlags != CLEARALARMS) alarmFlag = true;
+		sh.alarmFlag = alarmFlag;
+	}
+	return(n);
+}
+
+// Shard worker: count owned tanks past their timeOut and report each one once as it times out
+
+int shardCheckTimeouts(int s, unsigned long nowMs)
+{
+	tankShard& sh = shards[s];
+	int timedOut = 0;
+
+	for (int k = 0; k < sh.numOwn; k++)
+	{
+		tank& tk = sh.own[k];
+		if (tk.ignore || (nowMs - tk.lastMsgTime) <= tk.timeOut) continue;
+		timedOut++;
+		if (sh.timedOut[k] || tk.lastMsgTime == 0) continue;   // never heard from is not a transition
+
+		shardEvent* ev = sh.out.claim();
+		if (ev == nullptr) continue;   // retried next call
+		ev->type = SHARDEV_TIMEOUT;
+		ev->t = s + k * NUMSHARDS;
+		ev->msgTime = nowMs;
+		sh.out.push();
+		sh.timedOut[k] = true;
+	}
+	sh.timedOutCount = timedOut;
+	return(timedOut);
+}
+
+// Owner of tanks[] (loop()). Publishes shard results into tanks[] and runs the shared stages, returns the number of
+// events handled.
+
+int shardCollect()
+{
+	int n = 0;
+
+	for (int s = 0; s < NUMSHARDS; s++)
+	{
+		tankShard& sh = shards[s];
+		shardEvent* ev;
+
+		while ((ev = sh.out.front()) != nullptr)
+		{
+			int t = ev->t;
+			tank& tk = tanks[t];
+			const tank& st = ev->state;
+
+			switch (ev->type) {
+			case SHARDEV_READING:
+				tk.liquidDepth = st.liquidDepth;
+				tk.liquidDepthAvg = st.liquidDepthAvg;
+				tk.liquidVolume = st.liquidVolume;
+				tk.liquidVolumeAvg = st.liquidVolumeAvg;
+				tk.percentFull = st.percentFull;
+				tk.alarmFlags_prev = tk.alarmFlags;
+				tk.alarmFlags = st.alarmFlags;
+				tk.lastMsgTime = st.lastMsgTime;
+				tk.fcVolume = st.fcVolume;
+				tk.fcTime = st.fcTime;
+				tk.fcRate = st.fcRate;
+				tk.fcFlags = st.fcFlags;
+				tk.fcFastCount = st.fcFastCount;
+				tk.depth = st.depth;
+				tk.vCM = st.vCM;
+				tk.sonarOffset = st.sonarOffset;
+				tk.loAlarm = st.loAlarm;
+				tk.hiAlarm = st.hiAlarm;
+				tk.tankType = st.tankType;
+				tk.cfgHash = st.cfgHash;
+				memcpy(tk.node, ev->node, NODENAMELEN);   // always terminated by shardDrain()
+				if (ev->added)
+				{
+					tk.ignore = false;
+					aggAddTank(t);
+				}
+				aggUpdate(t);
+				jrnMsg(t, ev->msgTime);   // ahead of alarmCheck(), the journal holds a reading before its transitions
+				alarmCheck(t, ev->msgTime);
+				pumpOnReading(t, ev->ts);
+				histAdd(t, ev->ts);
+				rpcOnReading(t);
+				if (ev->pull && shardPullHook) shardPullHook(ev->node, startingTankNum + t);
+				if (shardReadingHook) shardReadingHook(t);
+				break;
+			case SHARDEV_TIMEOUT:
+				jrnTimeout(t, ev->msgTime);
+				break;
+			case SHARDEV_PULL:
+				if (shardPullHook) shardPullHook(ev->node, startingTankNum + t);
+				break;
+			}
+			sh.out.pop();
+			n++;
+		}
+	}
+	return(n);
+}
+
+// Owner of tanks[]: forget the static fields of tanks[t], so its next delta asks the node for a full message. False if
+// the shards are not set up or the shard has not caught up with earlier requests.
+
+bool shardResync(int t)
+{
+	tanks[t].cfgHash = 0;
+	if (shards == nullptr) return(false);
+
+	tankShard& sh = shards[shardOf(t)];
+	int* r = sh.resync.claim();
+
+	if (r == nullptr) return(false);
+	*r = t;
+	sh.resync.push();
+	return(true);
+}
+
+// Reader side summary, equivalent of globalAlarmFlag across all shards
+
+bool shardAnyAlarm()
+{
+	if (shards == nullptr) return(false);
+	for (int s = 0; s < NUMSHARDS; s++)
+		if (shards[s].alarmFlag) return(true);
+
+	return(false);
+}
+
+
+//
+// Connection manager
+//
+// Replaces the blocking connectWiFi()/connectMQTT() retry loops of earlier versions. connTick() is called from loop()
+// every pass, does at most one short step and returns, so sensing and local alarm logic keep running while offline.
+// Failed attempts back off exponentially with random jitter; after CONNWIFIATTEMPTS failures on one SSID it fails over
+// to the alternate SSID (if usealtssid is set) and back again.
+// The network calls are supplied by the sketch through connHooks so this works with whichever WiFi/MQTT client it uses.
+//
+
+#define CONNBACKOFFMIN    500L     // ms
+#define CONNBACKOFFMAX    60000L   // ms
+#define CONNWIFITIMEOUT   10000L   // ms to wait for association after WiFi.begin()
+#define CONNWIFIATTEMPTS  3        // attempts per SSID before failing over
+
+#define CONN_WIFI_START  0
+#define CONN_WIFI_WAIT   1
+#define CONN_MQTT        2
+#define CONN_ONLINE      3
+
+struct connHooks {
+	std::function<void(const char*, const char*)> wifiBegin;   // e.g. WiFi.begin(ssid, pwd)
+	std::function<bool()> wifiUp;                              // e.g. WiFi.status() == WL_CONNECTED
+	std::function<bool()> mqttConnect;                         // one attempt, e.g. client.connect(nodename, mqttUid, mqttPwd); keep the client socket timeout short
+	std::function<bool()> mqttUp;                              // e.g. client.connected()
+	std::function<void()> onWiFiUp;                            // optional, e.g. start UDP/OTA/time sync
+	std::function<void()> onOnline;                            // optional, e.g. subscribe to mqttTopicCtrl
+};
 
+connHooks connOps;
+std::uint8_t connState = CONN_WIFI_START;
+int connAttempts = 0;          // consecutive failures in the current state
+bool connUsingAlt = false;
+unsigned long connNextTry = 0L;
+unsigned long connStarted = 0L;
+
+// Backoff doubles per failure up to CONNBACKOFFMAX, with up to 50% random jitter so a site full of nodes coming back
+// after a power cut does not hit the AP/broker in lock step
+
+unsigned long connBackoff(int attempts)
+{
+	unsigned long d = CONNBACKOFFMIN;
+
+	while (attempts-- > 0 && d < CONNBACKOFFMAX) d *= 2;
+	if (d > CONNBACKOFFMAX) d = CONNBACKOFFMAX;
+	return(d + random(d / 2 + 1));
+}
+
+void connFail(unsigned long nowMs, std::uint8_t retryState)
+{
+	connNextTry = nowMs + connBackoff(connAttempts);
+	connAttempts++;
+	connState = retryState;
+}
+
+bool connOnline()
+{
+	return(connState == CONN_ONLINE);
+}
+
+// A link we had went down: restart at that step with a fresh attempt count, so the failures counted for the next step
+// do not trigger an SSID failover or a long backoff
+
+void connLost(std::uint8_t state)
+{
+	connAttempts = 0;
+	connState = state;
+}
+
+void connTick(unsigned long nowMs)
+{
+	if (!connOps.wifiBegin || !connOps.wifiUp || !connOps.mqttConnect || !connOps.mqttUp) return;   // hooks not set up yet
+	if ((long)(nowMs - connNextTry) < 0) return;
+
+	switch (connState) {
+	case CONN_WIFI_START:
+		if (connAttempts >= CONNWIFIATTEMPTS && wifiTryAlt)
+		{
+			connUsingAlt = !connUsingAlt;
+			connAttempts = 0;
+		}
+		if (debug)
+		{
+			Serial.print(F("\nWiFi connecting to "));
+			Serial.print(connUsingAlt ? assid : pssid);
+		}
+		connOps.wifiBegin(connUsingAlt ? assid : pssid, connUsingAlt ? apwd : ppwd);
+		connStarted = nowMs;
+		connState = CONN_WIFI_WAIT;
+		break;
+
+	case CONN_WIFI_WAIT:
+		if (connOps.wifiUp())
+		{
+			if (debug) Serial.print(F("\nWiFi connected"));
+			connAttempts = 0;
+			connState = CONN_MQTT;
+			if (connOps.onWiFiUp) connOps.onWiFiUp();
+		}
+		else if (nowMs - connStarted > CONNWIFITIMEOUT) connFail(nowMs, CONN_WIFI_START);
+		break;
+
+	case CONN_MQTT:
+		if (!connOps.wifiUp())
+		{
+			connLost(CONN_WIFI_START);
+			break;
+		}
+		if (connOps.mqttConnect())
+		{
+			if (debug) Serial.print(F("\nMQTT connected"));
+			connAttempts = 0;
+			connState = CONN_ONLINE;
+			if (connOps.onOnline) connOps.onOnline();
+		}
+		else connFail(nowMs, CONN_MQTT);
+		break;
+
+	case CONN_ONLINE:
+		if (!connOps.wifiUp()) connLost(CONN_WIFI_START);
+		else if (!connOps.mqttUp()) connLost(CONN_MQTT);
+		break;
+	}
+}
+
+
+//
+// Time service
+//
+// Asynchronous replacement for the old blocking getNtpTime(). ntpTick() sends a request when a sync is due and returns;
+// the sketch hands any UDP packet from port 123 to ntpReceive(). Each sync rebases a millis() -> UTC mapping and
+// measures how fast the local clock runs, so between syncs ntpNow() is a couple of integer operations and the resync
+// interval can grow from NTPMININTERVAL to NTPMAXINTERVAL once the drift estimate settles.
+// ntpRespond() builds a server reply and can stand in for an NTP server in a local test setup.
+//
+
+#define NTP_PACKET_SIZE   48
+#define NTPEPOCHOFFSET    2208988800UL   // seconds from 1900 to 1970
+#define NTPTIMEOUT        3000L          // ms to wait for a reply before retrying
+#define NTPMININTERVAL    300000L        // ms, resync interval until drift is known
+#define NTPMAXINTERVAL    86400000L      // ms, resync interval once drift is stable
+#define NTPDRIFTSTABLE    20.0F          // ppm, drift estimate change below which the interval is doubled
+#define NTPMINEPOCH       1577836800UL   // 2020-01-01, server times before this are garbage
+
+std::function<bool(const byte*, size_t)> ntpSend;   // e.g. Udp.beginPacket(ntpServerIP, 123); Udp.write(); Udp.endPacket()
+
+bool ntpSynced = false;
+unsigned long ntpBaseMs = 0L;          // millis() at last sync
+uint64_t ntpBaseEpochMs = 0;           // UTC ms since 1970 at last sync
+float ntpDriftPpm = 0;                 // local clock error, positive = millis() runs fast
+bool ntpDriftKnown = false;
+unsigned long ntpInterval = NTPMININTERVAL;
+unsigned long ntpNextSync = 0L;
+unsigned long ntpSentMs = 0L;
+bool ntpPending = false;
+int ntpRetries = 0;
+byte ntpCookie[8];                     // random transmit timestamp of the outstanding request, echoed back as originate
+
+// UTC ms since 1970 for the given millis(), 0 if never synced
+
+uint64_t ntpEpochMs(unsigned long nowMs)
+{
+	if (!ntpSynced) return(0);
+
+	unsigned long elapsed = nowMs - ntpBaseMs;
+	return(ntpBaseEpochMs + elapsed - (int64_t)(elapsed * ntpDriftPpm / 1000000.0F));
+}
+
+// Local time (timeZone/dst applied) in seconds, same convention as the old getNtpTime(). Suitable for setSyncProvider().
+
+time_t ntpNow()
+{
+	if (!ntpSynced) return(0);
+	return((time_t)(ntpEpochMs(millis()) / 1000) + (timeZone + (dst ? 1 : 0)) * SECS_PER_HOUR);
+}
+
+void ntpRequest(unsigned long nowMs)
+{
+	byte pkt[NTP_PACKET_SIZE];
+
+	memset(pkt, 0, NTP_PACKET_SIZE);
+	pkt[0] = 0b11100011;   // LI, Version, Mode
+	pkt[2] = 6;            // Polling Interval
+	pkt[3] = 0xEC;         // Peer Clock Precision
+	pkt[12] = 49;
+	pkt[13] = 0x4E;
+	pkt[14] = 49;
+	pkt[15] = 52;
+	for (int i = 0; i < 8; i++) ntpCookie[i] = (byte)random(256);
+	memcpy(pkt + 40, ntpCookie, 8);
+
+	if (ntpSend && ntpSend(pkt, NTP_PACKET_SIZE))
+	{
+		ntpSentMs = nowMs;
+		ntpPending = true;
+	}
+	else ntpNextSync = nowMs + NTPTIMEOUT;
+}
+
+void ntpRetry(unsigned long nowMs)
+{
+	ntpPending = false;
+	ntpNextSync = nowMs + (NTPTIMEOUT << (ntpRetries < 5 ? ntpRetries : 5));
+	ntpRetries++;
+}
+
+void ntpTick(unsigned long nowMs)
+{
+	if (ntpPending)
+	{
+		if (nowMs - ntpSentMs >= NTPTIMEOUT) ntpRetry(nowMs);   // lost reply, retry with backoff
+		return;
+	}
+	if ((long)(nowMs - ntpNextSync) >= 0) ntpRequest(nowMs);
+}
+
+// Only a server reply (mode 4) echoing our cookie as its originate timestamp is looked at, anything else on port 123
+// is ignored and the request stays outstanding. A reply from an unsynchronised server (LI 3, stratum 16 or more) or
+// with no usable transmit time counts as a failed attempt; a kiss-of-death (stratum 0) waits a full interval.
+
+void ntpReceive(const byte* pkt, size_t len, unsigned long nowMs)
+{
+	if (!ntpPending || len < NTP_PACKET_SIZE) return;
+	if ((pkt[0] & 0x07) != 4 || memcmp(pkt + 24, ntpCookie, 8) != 0) return;
+
+	std::uint8_t li = pkt[0] >> 6;
+	std::uint8_t stratum = pkt[1];
+	uint32_t secs = ((uint32_t)pkt[40] << 24) | ((uint32_t)pkt[41] << 16) | ((uint32_t)pkt[42] << 8) | pkt[43];
+	uint32_t frac = ((uint32_t)pkt[44] << 24) | ((uint32_t)pkt[45] << 16) | ((uint32_t)pkt[46] << 8) | pkt[47];
+	uint64_t unixSecs = (uint64_t)secs + ((secs & 0x80000000UL) ? 0 : 0x100000000ULL) - NTPEPOCHOFFSET;   // MSB clear = era 1, after 2036
+
+	if (stratum == 0)
+	{
+		ntpPending = false;
+		ntpNextSync = nowMs + ntpInterval;
+		return;
+	}
+	if (li == 3 || stratum >= 16 || (secs == 0 && frac == 0) || unixSecs < NTPMINEPOCH)
+	{
+		ntpRetry(nowMs);
+		return;
+	}
+
+	unsigned long rtt = nowMs - ntpSentMs;
+	uint64_t epochMs = unixSecs * 1000 + (((uint64_t)frac * 1000) >> 32) + rtt / 2;
+
+	ntpPending = false;
+	ntpRetries = 0;
+
+	if (ntpSynced)
+	{
+		// drift = (local elapsed - true elapsed) / true elapsed over the interval since the last sync
+		unsigned long local = nowMs - ntpBaseMs;
+		float trueElapsed = (float)(int64_t)(epochMs - ntpBaseEpochMs);
+		if (trueElapsed > 60000.0F)
+		{
+			float drift = (local - trueElapsed) * 1000000.0F / trueElapsed;
+			float change = drift - ntpDriftPpm;
+			ntpDriftPpm = ntpDriftKnown ? ntpDriftPpm + 0.5F * change : drift;
+			if (ntpDriftKnown && fabsf(change) < NTPDRIFTSTABLE && ntpInterval < NTPMAXINTERVAL) ntpInterval *= 2;
+			else if (fabsf(change) >= NTPDRIFTSTABLE) ntpInterval = NTPMININTERVAL;
+			if (ntpInterval > NTPMAXINTERVAL) ntpInterval = NTPMAXINTERVAL;
+			ntpDriftKnown = true;
+		}
+	}
+
+	ntpBaseMs = nowMs;
+	ntpBaseEpochMs = epochMs;
+	ntpSynced = true;
+	ntpNextSync = nowMs + ntpInterval;
+}
+
+// Stand-in server: fill resp with a reply to req carrying the given UTC ms time. Returns the reply length, 0 if req is not a client request.
+
+size_t ntpRespond(const byte* req, size_t len, byte* resp, uint64_t epochMs)
+{
+	if (len < NTP_PACKET_SIZE || (req[0] & 0x07) != 3) return(0);
+
+	uint32_t secs = (uint32_t)(epochMs / 1000) + NTPEPOCHOFFSET;
+	uint32_t frac = (uint32_t)(((epochMs % 1000) << 32) / 1000);
+
+	memset(resp, 0, NTP_PACKET_SIZE);
+	resp[0] = (req[0] & 0x38) | 0x04;   // same version, mode 4 = server
+	resp[1] = 1;                        // stratum 1
+	memcpy(resp + 24, req + 40, 8);     // originate = client transmit
+	for (int i = 0; i < 4; i++)
+	{
+		resp[32 + i] = resp[40 + i] = (secs >> (24 - 8 * i)) & 0xFF;   // receive and transmit timestamps
+		resp[36 + i] = resp[44 + i] = (frac >> (24 - 8 * i)) & 0xFF;
+	}
+	return(NTP_PACKET_SIZE);
+}
+
+
+//
+// Delta state sync
+//
+// Static tank fields (tT, d, vCM, sO, loA, hiA) rarely change, so a sensor only sends them in a full message and
+// otherwise sends the dynamic fields plus a hash of the static ones ("cH"). When the manager's hash for that tank does
+// not match (config changed, or the manager restarted and knows nothing) it publishes a pull request on the control
+// topic and the sensor sends a full message next time. Sensors start with syncFull set so a reboot also resends them.
+//
+
+#define SYNCCMD "sync"
+
+uint32_t syncHash(const tank& tk)
+{
+	uint32_t h = 2166136261UL;   // FNV-1a
+	float f[5] = { tk.depth, tk.vCM, (float)tk.sonarOffset, tk.loAlarm, tk.hiAlarm };
+	const byte* b = (const byte*)f;
+
+	for (size_t i = 0; i < sizeof(f); i++) h = (h ^ b[i]) * 16777619UL;
+	for (const char* c = tk.tankType; c != nullptr && *c; c++) h = (h ^ (byte)*c) * 16777619UL;
+	return(h ? h : 1);   // 0 is reserved for unknown
+}
+
+// Sensor side: build the tank message for tk, full or delta as required
+
+void syncTankMsg(JsonDocument& doc, const char* node, tank& tk, int tankNum)
+{
+	doc.clear();
+	doc["n"] = node;
+	doc["t"] = tankNum;
+	doc["lD"] = tk.liquidDepth;
+	doc["lDAvg"] = tk.liquidDepthAvg;
+	doc["lV"] = tk.liquidVolume;
+	doc["lvAvg"] = tk.liquidVolumeAvg;
+	doc["pF"] = tk.percentFull;
+	doc["aF"] = tk.alarmFlags;
+	doc["cH"] = syncHash(tk);
+
+	if (tk.syncFull)
+	{
+		doc["tT"] = tk.tankType;
+		doc["d"] = tk.depth;
+		doc["vCM"] = tk.vCM;
+		doc["sO"] = tk.sonarOffset;
+		doc["loA"] = tk.loAlarm;
+		doc["hiA"] = tk.hiAlarm;
+		tk.syncFull = false;
+	}
+}
+
+void syncTankMsg(JsonDocument& doc, const char* node, int t, int tankNum)
+{
+	syncTankMsg(doc, node, tanks[t], tankNum);
+}
+
+// Sensor side: a pull request for this node arrived on the control topic, returns true if it was for us
+
+bool syncOnPull(JsonDocument& ctrl, const char* node)
+{
+	const char* n = ctrl["n"];
+	int tankNum = ctrl["t"] | -1;
+
+	if (strcmp(ctrl["cmd"] | "", SYNCCMD) != 0 || n == nullptr || strcmp(n, node) != 0) return(false);
+
+	for (int t = 0; t < numtanks; t++)
+		if (tankNum < 0 || tankNum == startingTankNum + t) tanks[t].syncFull = true;
+
+	return(true);
+}
+
+// Tank types are one letter, the aggregates key on it. A tank the manager has no config for (gateway slot, depth 0)
+// takes its type from the full message; the pointer has to outlive the message, so it points into this table.
+
+const char syncTypeNames[] = "A\0B\0C\0D\0E\0F\0G\0H\0I\0J\0K\0L\0M\0N\0O\0P\0Q\0R\0S\0T\0U\0V\0W\0X\0Y\0Z";
+
+const char* syncTypeName(const char* tT, const char* def)
+{
+	char c = (tT != nullptr) ? tT[0] : 0;
+
+	if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+	if (c < 'A' || c > 'Z') return(def);
+	return(syncTypeNames + (c - 'A') * 2);
+}
+
+// Manager side: apply a received message to tk. Returns true if a full snapshot must be pulled (see syncPullMsg).
+
+bool syncApply(JsonDocument& doc, tank& tk)
+{
+	uint32_t hash = doc["cH"] | 0UL;
+
+	tk.liquidDepth = doc["lD"] | tk.liquidDepth;
+	tk.liquidDepthAvg = doc["lDAvg"] | tk.liquidDepthAvg;
+	tk.liquidVolume = doc["lV"] | tk.liquidVolume;
+	tk.liquidVolumeAvg = doc["lvAvg"] | tk.liquidVolumeAvg;
+	tk.percentFull = doc["pF"] | tk.percentFull;
+	tk.alarmFlags_prev = tk.alarmFlags;
+	tk.alarmFlags = doc["aF"] | tk.alarmFlags;
+
+	if (doc.containsKey("d"))
+	{
+		if (tk.depth == 0) tk.tankType = syncTypeName(doc["tT"].as<const char*>(), tk.tankType);   // unconfigured slot
+		tk.depth = doc["d"];
+		tk.vCM = doc["vCM"];
+		tk.sonarOffset = doc["sO"];
+		tk.loAlarm = doc["loA"];
+		tk.hiAlarm = doc["hiA"];
+		tk.cfgHash = hash;    // a configured tankType stays as is, the hash only detects a change
+		return(false);
+	}
+	return(hash != 0 && hash != tk.cfgHash);
+}
+
+bool syncApply(JsonDocument& doc, int t)
+{
+	return(syncApply(doc, tanks[t]));
+}
+
+void syncPullMsg(JsonDocument& doc, const char* node, int tankNum)
+{
+	doc.clear();
+	doc["cmd"] = SYNCCMD;
+	doc["n"] = node;
+	doc["t"] = tankNum;
+}
+
+
+//
+// Compact message encodings
+//
+// Keyed JSON repeats every key in every message. The positional encodings drop the keys and send the values as an
+// array in msgKeys[] order (trailing absent fields omitted, absent fields in between sent as null), either as JSON
+// text, which third-party consumers can still read, or as MessagePack. msgDecode() recognises all three from the
+// first byte so a receiver does not need to know which encoding a topic uses, and always yields the keyed form.
+//
+
+// Encode doc into out. scratch is used for the positional forms and is overwritten. Returns the encoded length, 0 on overflow.
+
+size_t msgEncode(JsonDocument& doc, int enc, char* out, size_t len, JsonDocument& scratch)
+{
+	char key[8];
+	int last = -1;
+
+	if (enc == ENC_JSON) return(serializeJson(doc, out, len));
+
+	for (size_t k = 0; k < NUMMSGKEYS; k++)
+		if (!doc[pgmReadStr(key, pgmRead(msgKeys[k]), sizeof(key))].isNull()) last = k;
+
+	JsonArray arr = scratch.to<JsonArray>();
+	for (int k = 0; k <= last; k++) arr.add(doc[pgmReadStr(key, pgmRead(msgKeys[k]), sizeof(key))]);
+	if (scratch.overflowed()) return(0);
+
+	if (enc == ENC_MSGPACK) return(serializeMsgPack(scratch, out, len));
+	return(serializeJson(scratch, out, len));
+}
+
+bool msgDecode(const char* in, size_t len, JsonDocument& doc, JsonDocument& scratch)
+{
+	char key[8];
+	DeserializationError err;
+
+	if (len == 0) return(false);
+	if (in[0] == '{') return(!deserializeJson(doc, in, len));
+
+	if (in[0] == '[') err = deserializeJson(scratch, in, len);
+	else err = deserializeMsgPack(scratch, in, len);
+	if (err || !scratch.is<JsonArray>()) return(false);
+
+	JsonArray arr = scratch.as<JsonArray>();
+	doc.clear();
+	for (size_t k = 0; k < NUMMSGKEYS && k < arr.size(); k++)
+		if (!arr[k].isNull()) doc[pgmReadStr(key, pgmRead(msgKeys[k]), sizeof(key))] = arr[k];
+
+	return(!doc.overflowed());
+}
+
+// Sensor side: the message for tanks[t] built into tankmsg and encoded for the data topic (msgEncData) into payloadBuff.
+// Returns the length to publish, 0 on overflow.
+
+size_t msgTankPayload(const char* node, int t, int tankNum)
+{
+	syncTankMsg(tankmsg, node, t, tankNum);
+	return(msgEncode(tankmsg, msgEncData, payloadBuff, memPlan.payload, msgScratch));
+}
+
+
+//
+// Sonar calibration
+//
+// The speed of sound changes about 0.17%/C, which is several cm over a season on a deep tank. calSetTemperature()
+// recomputes it and calTransform() folds it, depth, sonarOffset and the per tank linear calibration (calA/calB) into one
+// gain and bias, so a reading is calReading() = one multiply-add on the raw echo time.
+// Calibration points (measured vs. dipstick depth) are accumulated as least squares sums so any number can be added.
+// calPlateau() watches for the level sitting at full or empty for CALPLATEAUTIME and suggests a sonarOffset correction.
+//
+
+#define CALPLATEAUBAND  1.0F     // cm, level must stay within this band to count as a plateau
+#define CALPLATEAUTIME  21600L   // seconds (6 h) at a plateau before suggesting a correction
+#define CALFULLFRAC     0.98F    // plateau above this fraction of depth = full (overflow level)
+#define CALEMPTYFRAC    0.02F    // plateau below this fraction of depth = empty (sump level)
+
+float soundSpeed = 343.4F;       // m/s, 20C
+
+void calTransform(int t)
+{
+	tank& tk = tanks[t];
+	float cmPerUs = soundSpeed / 20000.0F;   // round trip: m/s -> cm/us, halved
+
+	// liquid depth = calA * (depth + sonarOffset - distance) + calB
+	tk.calGain = -tk.calA * cmPerUs;
+	tk.calBias = tk.calA * (tk.depth + tk.sonarOffset) + tk.calB;
+}
+
+void calSetTemperature(float degC)
+{
+	soundSpeed = 331.3F + 0.606F * degC;
+	for (int t = 0; t < numtanks; t++) calTransform(t);
+}
+
+float calReading(int t, unsigned long echoUs)
+{
+	return(tanks[t].calGain * echoUs + tanks[t].calBias);
+}
+
+// Add one point: measured = what the sensor reported (uncalibrated depth), actual = dipstick depth, both cm
+
+void calAddPoint(int t, float measured, float actual)
+{
+	tank& tk = tanks[t];
+
+	tk.calN += 1;
+	tk.calSx += measured;
+	tk.calSy += actual;
+	tk.calSxx += measured * measured;
+	tk.calSxy += measured * actual;
+}
+
+// Fit calA/calB from the points so far. One point gives an offset only, two or more a full linear fit.
+
+bool calSolve(int t)
+{
+	tank& tk = tanks[t];
+	float den = tk.calN * tk.calSxx - tk.calSx * tk.calSx;
+
+	if (tk.calN < 1) return(false);
+	if (tk.calN < 2 || fabsf(den) < 1e-3F)
+	{
+		tk.calA = 1.0F;
+		tk.calB = (tk.calSy - tk.calSx) / tk.calN;
+	}
+	else
+	{
+		tk.calA = (tk.calN * tk.calSxy - tk.calSx * tk.calSy) / den;
+		tk.calB = (tk.calSy - tk.calA * tk.calSx) / tk.calN;
+	}
+	calTransform(t);
+	return(true);
+}
+
+void calClear(int t)
+{
+	tank& tk = tanks[t];
+
+	tk.calN = tk.calSx = tk.calSy = tk.calSxx = tk.calSxy = 0;
+	tk.calA = 1.0F;
+	tk.calB = 0;
+	calTransform(t);
+}
+
+// Call per reading with the calibrated level. Returns true when a new offset suggestion is available in calSuggest.
+// Clear calSuggested once the suggestion has been applied or dismissed to allow the next one.
+
+bool calPlateau(int t, float level, unsigned long ts)
+{
+	tank& tk = tanks[t];
+	float target;
+
+	if (tk.plateauSince == 0 || fabsf(level - tk.plateauLevel) > CALPLATEAUBAND)
+	{
+		tk.plateauLevel = level;
+		tk.plateauSince = ts;
+		return(false);
+	}
+	if (ts - tk.plateauSince < CALPLATEAUTIME || tk.calSuggested) return(false);
+
+	if (tk.plateauLevel >= CALFULLFRAC * tk.depth) target = tk.depth;
+	else if (tk.plateauLevel <= CALEMPTYFRAC * tk.depth) target = 0;
+	else return(false);
+
+	tk.calSuggest = target - tk.plateauLevel;   // reading too low = sensor further away than configured, increase offset
+	tk.calSuggested = fabsf(tk.calSuggest) >= CALPLATEAUBAND;
+	return(tk.calSuggested);
+}
+
+
+//
+// Alarm notifications
+//
+// Instead of every consumer (Blynk, MQTT, display) polling globalAlarmFlag, sinks register with alarmSubscribe() and
+// alarmCheck(t) posts an event to every sink whenever a tank's alarm flags change. Each sink has its own bounded queue,
+// so a slow or offline sink only loses its own oldest low priority events. An event that repeats the state of the same
+// tank/alarm still queued is merged into it; with nothing queued for that tank/alarm, one that repeats the state last
+// delivered inside the sink's coalesce window is dropped. A change of state is always queued on its own, so a raise,
+// clear, raise flap reaches the sink as three events and an undelivered raise is never merged away.
+// alarmDispatch() delivers at most a fixed number of events per call, highest priority first (MAXDEPTH, then alarms on
+// tanks linked to a pump, then HI/LO) and in posting order within a priority, honouring each sink's minimum interval.
+//
+
+#define MAXALARMSINKS    4
+#define ALARMQUEUESIZE   8
+#define ALARMDISPATCHMAX 4       // events delivered per alarmDispatch() call, across all sinks
+
+struct alarmEvent {
+	int t;                        // tank index
+	std::uint8_t alarmType;       // HIALARM, LOALARM, MAXDEPTH
+	bool raised;                  // false = cleared
+	std::uint8_t priority;        // higher first
+	int count;                    // events coalesced into this one
+	unsigned long ms;             // millis() of the latest occurrence
+};
+
+struct alarmSink {
+	std::function<bool(const alarmEvent&)> deliver;   // return false to keep the event and retry later
+	unsigned long minInterval;    // ms between deliveries
+	unsigned long coalesceWindow; // ms
+	unsigned long lastDelivery;
+	alarmEvent queue[ALARMQUEUESIZE];
+	int queued;
+	alarmEvent recent[ALARMQUEUESIZE];   // last delivered state per tank/alarm, least recently delivered replaced first
+	unsigned long dropped;
+	unsigned long coalesced;
+};
+
+alarmSink alarmSinks[MAXALARMSINKS];
+int numAlarmSinks = 0;
+
+int alarmSubscribe(std::function<bool(const alarmEvent&)> deliver, unsigned long minInterval, unsigned long coalesceWindow)
+{
+	if (numAlarmSinks >= MAXALARMSINKS) return(-1);
+
+	alarmSink& sk = alarmSinks[numAlarmSinks];
+	sk = alarmSink();
+	sk.deliver = deliver;
+	sk.minInterval = minInterval;
+	sk.coalesceWindow = coalesceWindow;
+	for (int i = 0; i < ALARMQUEUESIZE; i++) sk.recent[i].t = -1;
+	return(numAlarmSinks++);
+}
+
+std::uint8_t alarmPriority(int t, std::uint8_t alarmType)
+{
+	if (alarmType == MAXDEPTH || alarmType == PUMPFAULT) return(3);
+	if (tanks[t].pumpNode != 0) return(2);
+	return(1);
+}
+
+// Last state of tanks[t]'s alarmType delivered to this sink, nullptr if not remembered
+
+alarmEvent* alarmRecent(alarmSink& sk, int t, std::uint8_t alarmType)
+{
+	for (int i = 0; i < ALARMQUEUESIZE; i++)
+		if (sk.recent[i].t == t && sk.recent[i].alarmType == alarmType) return(&sk.recent[i]);
+
+	return(nullptr);
+}
+
+// Remove queue[i], keeping the posting order of the rest
+
+void alarmDequeue(alarmSink& sk, int i)
+{
+	for (; i < sk.queued - 1; i++) sk.queue[i] = sk.queue[i + 1];
+	sk.queued--;
+}
+
+void alarmPostSink(alarmSink& sk, const alarmEvent& ev)
+{
+	int lowest = -1;
+	int last = -1;   // latest queued event for this tank/alarm
+
+	for (int i = 0; i < sk.queued; i++)
+	{
+		alarmEvent& q = sk.queue[i];
+		if (q.t == ev.t && q.alarmType == ev.alarmType) last = i;
+		if (lowest < 0 || q.priority < sk.queue[lowest].priority) lowest = i;
+	}
+
+	if (last >= 0 && sk.queue[last].raised == ev.raised)
+	{
+		sk.queue[last].ms = ev.ms;
+		sk.queue[last].count++;
+		sk.coalesced++;
+		return;
+	}
+	if (last < 0)
+	{
+		alarmEvent* r = alarmRecent(sk, ev.t, ev.alarmType);
+		if (r != nullptr && r->raised == ev.raised && ev.ms - r->ms < sk.coalesceWindow)
+		{
+			sk.coalesced++;
+			return;
+		}
+	}
+
+	if (sk.queued == ALARMQUEUESIZE)
+	{
+		sk.dropped++;
+		if (sk.queue[lowest].priority >= ev.priority) return;
+		alarmDequeue(sk, lowest);
+	}
+	sk.queue[sk.queued++] = ev;
+}
+
+void alarmPost(int t, std::uint8_t alarmType, bool raised, unsigned long nowMs)
+{
+	alarmEvent ev = { t, alarmType, raised, alarmPriority(t, alarmType), 1, nowMs };
+
+	for (int s = 0; s < numAlarmSinks; s++) alarmPostSink(alarmSinks[s], ev);
+}
+
+// Post events for each alarm bit of tanks[t] that differs from alarmFlags_prev
+
+void alarmCheck(int t, unsigned long nowMs)
+{
+	std::uint8_t changed = tanks[t].alarmFlags ^ tanks[t].alarmFlags_prev;
+
+	for (int a = 0; a < NUMALARMS; a++)
+	{
+		std::uint8_t mask = alarmTypeAt(a);
+		if (!(changed & mask)) continue;
+		if (!(tanks[t].alarmFlags & mask)) tanks[t].alarmAck &= ~mask;
+		if (debug)
+		{
+			char name[10];
+			msgn = snprintf(msgbuff, MSGBUFFLEN, "\ntanks[%i] %s %s", t, alarmNameAt(a, name, sizeof(name)), (tanks[t].alarmFlags & mask) ? "raised" : "cleared");
+			outputMsg(msgbuff);
+		}
+		alarmPost(t, mask, (tanks[t].alarmFlags & mask) != 0, nowMs);
+		jrnAlarm(t, mask, (tanks[t].alarmFlags & mask) != 0, nowMs);
+	}
+}
+
+// Highest priority queued event, the earliest posted of equal ones. Raises acknowledged while queued are dropped on the
+// way, nothing to tell. -1 if nothing is left.
+
+int alarmNext(alarmSink& sk)
+{
+	while (sk.queued > 0)
+	{
+		int best = 0;
+
+		for (int i = 1; i < sk.queued; i++)
+			if (sk.queue[i].priority > sk.queue[best].priority) best = i;
+
+		const alarmEvent& q = sk.queue[best];
+		if (!q.raised || !(tanks[q.t].alarmAck & q.alarmType)) return(best);
+		alarmDequeue(sk, best);
+	}
+	return(-1);
+}
+
+int alarmDispatch(unsigned long nowMs)
+{
+	int delivered = 0;
+
+	for (int s = 0; s < numAlarmSinks && delivered < ALARMDISPATCHMAX; s++)
+	{
+		alarmSink& sk = alarmSinks[s];
+		int best;
+
+		if (sk.queued == 0 || nowMs - sk.lastDelivery < sk.minInterval) continue;
+		if ((best = alarmNext(sk)) < 0) continue;
+
+		alarmEvent ev = sk.queue[best];
+		if (!sk.deliver(ev)) continue;
+		alarmDequeue(sk, best);
+
+		alarmEvent* r = alarmRecent(sk, ev.t, ev.alarmType);
+		if (r == nullptr)   // remember it in place of the least recently delivered
+		{
+			r = &sk.recent[0];
+			for (int i = 1; i < ALARMQUEUESIZE && r->t >= 0; i++)
+				if (sk.recent[i].t < 0 || nowMs - sk.recent[i].ms > nowMs - r->ms) r = &sk.recent[i];
+		}
+		*r = ev;
+		r->ms = nowMs;
+		sk.lastDelivery = nowMs;
+		delivered++;
+	}
+	return(delivered);
+}
+
+//
+// Multi-site federation
+//
+// Site managers publish to an upstream aggregator: aggSummaryMsg() for the site totals plus fedDeltaMsg(), which carries
+// only the tanks whose volume or alarm flags (as last counted by aggUpdate) changed since the last acknowledged publish.
+// A tank only counts as sent once fedAck() has been called with the message after a successful publish, so a failed
+// publish is simply repeated by the next delta. Every FEDFULLINTERVAL (and after boot or a pull) the site sends a full
+// snapshot ("f":1) instead, which keeps a quiet site from expiring and rebuilds an aggregator that lost its state.
+// Tank numbers are only unique within a site, so the aggregator indexes tanks by (site, tank number) and never renumbers
+// them. Its tables are fixed size (FEDMAXSITES sites, FEDMAXTANKS tanks) and allocated by fedInit(), so only an
+// aggregator pays for them; anything beyond that is counted in fedRejected rather than allocated. When a delta arrives from a site it has no snapshot for, fedApply() asks for a pull and the
+// aggregator publishes fedCtrlMsg(..., FEDPULLCMD) on the control topic.
+// Control flows down with fedCtrlMsg(); a site manager uses fedForSite() to pick out messages addressed to it.
+//
+
+#define FEDMAXSITES     16
+#define FEDMAXTANKS     256
+#define FEDHASHSIZE     512      // power of 2, >= 2 * FEDMAXTANKS
+#define FEDSITENAMELEN  24
+#define FEDSITETIMEOUT  3600000L // ms without a message before a site and its tanks are dropped
+#define FEDFULLINTERVAL 900000L  // ms between full snapshots from a site manager
+#define FEDPULLRETRY    60000L   // ms before the aggregator repeats a pull to a site still without a snapshot
+#define FEDPULLCMD      "pull"
+
+#if FEDFULLINTERVAL >= FEDSITETIMEOUT
+#error FEDFULLINTERVAL must be shorter than FEDSITETIMEOUT or quiet sites expire between snapshots
+#endif
+
+/*  JSON Federation Delta Structure
+  {
+	"s"         // site name
+	"f"         // 1 = full snapshot of every tank, absent in a delta
+	"d"         // [[tank number, volume in 0.1 L, alarm flags], ...]
+  }
+*/
+
+// Site manager side
+
+bool fedFullPending = true;      // boot or pull: next publish is a full snapshot
+unsigned long fedLastFull = 0L;  // ms of the last acknowledged snapshot
+
+bool fedFullDue(unsigned long nowMs)
+{
+	return(fedFullPending || nowMs - fedLastFull >= FEDFULLINTERVAL);
+}
+
+// Build a delta, or a snapshot if full is set. Returns the number of tanks included; a delta with 0 needs no publish.
+// Nothing is marked as sent here, call fedAck() once the message has been published.
+
+int fedDeltaMsg(JsonDocument& doc, int maxTanks, bool full = false)
+{
+	JsonObject root = doc.to<JsonObject>();
+	JsonArray d;
+	int n = 0;
+
+	root["s"] = sitename;
+	if (full) root["f"] = 1;
+	d = root.createNestedArray("d");
+	for (int t = 0; t < numtanks && n < maxTanks; t++)
+	{
+		if (tanks[t].ignore) continue;
+		if (!full && tanks[t].aggVolume == tanks[t].fedVolume && tanks[t].aggFlags == tanks[t].fedFlags) continue;
+
+		JsonArray e = d.createNestedArray();
+		e.add(startingTankNum + t);
+		e.add(tanks[t].aggVolume);
+		e.add(tanks[t].aggFlags);
+		n++;
+	}
+	return(n);
+}
+
+// The message built by fedDeltaMsg() was published: record what the aggregator now has. Values are taken from the
+// message, not tanks[], so a change made after it was built still goes out in the next delta.
+
+void fedAck(JsonDocument& doc, unsigned long nowMs)
+{
+	JsonArray d = doc["d"];
+
+	for (size_t i = 0; i < d.size(); i++)
+	{
+		int t = (d[i][0] | -1) - startingTankNum;
+		if (t < 0 || t >= numtanks) continue;
+		tanks[t].fedVolume = d[i][1];
+		tanks[t].fedFlags = d[i][2];
+	}
+	if (doc["f"] | 0)
+	{
+		fedFullPending = false;
+		fedLastFull = nowMs;
+	}
+}
+
+bool fedForSite(JsonDocument& ctrl)
+{
+	const char* site = ctrl["s"];
+	return(site != nullptr && strcmp(site, sitename) == 0);
+}
+
+// Control message for this site asking for a snapshot: the next publish is full. Returns true if it was one.
+
+bool fedOnPull(JsonDocument& ctrl)
+{
+	const char* cmd = ctrl["cmd"];
+
+	if (!fedForSite(ctrl) || cmd == nullptr || strcmp(cmd, FEDPULLCMD) != 0) return(false);
+	fedFullPending = true;
+	return(true);
+}
+
+// Aggregator side
+
+struct fedSite {
+	char name[FEDSITENAMELEN];
+	unsigned long lastMs;
+	unsigned long pullMs;        // last pull requested
+	bool pulled;                 // pullMs is valid
+	bool synced;                 // a full snapshot has been applied
+	bool used;
+};
+
+struct fedTank {
+	std::uint8_t site;
+	int tankNum;
+	long volume;                 // 0.1 L
+	std::uint8_t alarmFlags;
+	unsigned long lastMs;
+};
+
+fedSite* fedSites = nullptr;     // FEDMAXSITES, the tables are allocated by fedInit()
+fedTank* fedTanks = nullptr;     // FEDMAXTANKS
+int16_t* fedHash = nullptr;      // FEDHASHSIZE, index into fedTanks, -1 = empty
+int numFedTanks = 0;
+unsigned long fedRejected = 0;
+
+// Aggregator only, call once before the first fedApply(). Calling it again clears the tables.
+
+void fedInit()
+{
+	if (fedSites == nullptr)
+	{
+		fedSites = new fedSite[FEDMAXSITES];
+		fedTanks = new fedTank[FEDMAXTANKS];
+		fedHash = new int16_t[FEDHASHSIZE];
+	}
+	memset(fedSites, 0, FEDMAXSITES * sizeof(fedSite));
+	for (int i = 0; i < FEDHASHSIZE; i++) fedHash[i] = -1;
+	numFedTanks = 0;
+	fedRejected = 0;
+}
+
+uint32_t fedSlot(int site, int tankNum)
+{
+	return((((uint32_t)site * 2654435761UL) ^ ((uint32_t)tankNum * 40503UL)) & (FEDHASHSIZE - 1));
+}
+
+int fedFindSite(const char* name, bool add)
+{
+	int freeSlot = -1;
+
+	if (fedSites == nullptr) return(-1);   // not an aggregator
+	for (int s = 0; s < FEDMAXSITES; s++)
+	{
+		if (fedSites[s].used && strncmp(fedSites[s].name, name, FEDSITENAMELEN - 1) == 0) return(s);
+		if (!fedSites[s].used && freeSlot < 0) freeSlot = s;
+	}
+	if (!add || freeSlot < 0) return(-1);
+
+	strncpy(fedSites[freeSlot].name, name, FEDSITENAMELEN - 1);
+	fedSites[freeSlot].name[FEDSITENAMELEN - 1] = 0;
+	fedSites[freeSlot].pulled = false;
+	fedSites[freeSlot].synced = false;
+	fedSites[freeSlot].used = true;
+	return(freeSlot);
+}
+
+fedTank* fedFind(int site, int tankNum, bool add)
+{
+	uint32_t h = fedSlot(site, tankNum);
+
+	while (fedHash[h] >= 0)
+	{
+		fedTank& ft = fedTanks[fedHash[h]];
+		if (ft.site == site && ft.tankNum == tankNum) return(&ft);
+		h = (h + 1) & (FEDHASHSIZE - 1);
+	}
+	if (!add || numFedTanks >= FEDMAXTANKS) return(nullptr);
+
+	fedHash[h] = numFedTanks;
+	fedTanks[numFedTanks].site = site;
+	fedTanks[numFedTanks].tankNum = tankNum;
+	return(&fedTanks[numFedTanks++]);
+}
+
+fedTank* fedLookup(const char* siteName, int tankNum)
+{
+	int s = fedFindSite(siteName, false);
+	return(s < 0 ? nullptr : fedFind(s, tankNum, false));
+}
+
+// Apply a delta or snapshot from a site manager. Returns true when the site should be sent a pull: a delta from a site
+// with no snapshot (new, expired, or this aggregator restarted) only covers the tanks that changed. Repeated at most
+// every FEDPULLRETRY while the snapshot does not arrive.
+
+bool fedApply(JsonDocument& doc, unsigned long nowMs)
+{
+	const char* name = doc["s"];
+	bool pull = false;
+	int s;
+
+	if (name == nullptr || (s = fedFindSite(name, true)) < 0)
+	{
+		fedRejected++;
+		return(false);
+	}
+	fedSite& site = fedSites[s];
+	site.lastMs = nowMs;
+	if (doc["f"] | 0) site.synced = true;
+	else if (!site.synced && (!site.pulled || nowMs - site.pullMs >= FEDPULLRETRY))
+	{
+		site.pulled = true;
+		site.pullMs = nowMs;
+		pull = true;
+	}
+
+	JsonArray d = doc["d"];
+	for (size_t i = 0; i < d.size(); i++)
+	{
+		fedTank* ft = fedFind(s, d[i][0], true);
+		if (ft == nullptr)
+		{
+			fedRejected++;
+			continue;
+		}
+		ft->volume = d[i][1];
+		ft->alarmFlags = d[i][2];
+		ft->lastMs = nowMs;
+	}
+	return(pull);
+}
+
+// Drop sites that have gone quiet, then compact the tank table and rebuild the hash index. Call occasionally.
+
+void fedExpire(unsigned long nowMs)
+{
+	int n = 0;
+
+	if (fedSites == nullptr) return;
+	for (int s = 0; s < FEDMAXSITES; s++)
+		if (fedSites[s].used && nowMs - fedSites[s].lastMs > FEDSITETIMEOUT) fedSites[s].used = false;
+
+	for (int i = 0; i < FEDHASHSIZE; i++) fedHash[i] = -1;
+	for (int i = 0; i < numFedTanks; i++)
+	{
+		if (!fedSites[fedTanks[i].site].used) continue;
+		fedTanks[n] = fedTanks[i];
+		uint32_t h = fedSlot(fedTanks[n].site, fedTanks[n].tankNum);
+		while (fedHash[h] >= 0) h = (h + 1) & (FEDHASHSIZE - 1);
+		fedHash[h] = n++;
+	}
+	numFedTanks = n;
+}
+
+void fedCtrlMsg(JsonDocument& doc, const char* siteName, int tankNum, const char* cmd)
+{
+	doc.clear();
+	doc["s"] = siteName;
+	doc["t"] = tankNum;
+	doc["cmd"] = cmd;
+}
+
+
+//
+// Adaptive ping rate
+//
+// Each tank pings between its minPingDelay and maxPingDelay (tankdefs "minpingdelay"/"maxpingdelay", ms; both default
+// to tankpingdelay, which gives the old fixed rate). After each reading pingUpdate() halves the interval when the level
+// is moving faster than PINGFASTRATE or is within PINGNEARFRAC of an alarm level, and stretches it by half again when
+// the level has been still, so filling or pumped tanks are sampled quickly and idle cisterns rarely.
+//
+
+#define PINGFASTRATE    0.5F     // cm/minute
+#define PINGSTILLRATE   0.05F    // cm/minute
+#define PINGNEARFRAC    0.05F    // fraction of depth from lo/hi alarm level
+
+bool pingDue(int t, unsigned long nowMs)
+{
+	return(!tanks[t].pingValid || nowMs - tanks[t].lastPingTime >= (unsigned long)tanks[t].pingDelay);
+}
+
+void pingUpdate(int t, unsigned long nowMs)
+{
+	tank& tk = tanks[t];
+	float level = tk.liquidDepth;
+	float minutes = (nowMs - tk.lastPingTime) / 60000.0F;
+	float near = PINGNEARFRAC * tk.depth;
+
+	if (tk.pingValid && minutes > 0)
+	{
+		float rate = fabsf(level - tk.lastPingDepth) / minutes;
+
+		if (rate > PINGFASTRATE || level - tk.loAlarm < near || tk.hiAlarm - level < near) tk.pingDelay /= 2;
+		else if (rate < PINGSTILLRATE) tk.pingDelay += tk.pingDelay / 2 + 1;
+
+		if (tk.pingDelay < tk.minPingDelay) tk.pingDelay = tk.minPingDelay;
+		if (tk.pingDelay > tk.maxPingDelay) tk.pingDelay = tk.maxPingDelay;
+	}
+	tk.lastPingDepth = level;
+	tk.lastPingTime = nowMs;
+	tk.pingValid = true;
+}
+
+
+//
+// Event journal and replay
+//
+// A compact binary log of what the manager saw: inbound tank readings, alarm transitions and timeouts, each stamped with
+// millis(). Records are packed little endian with no padding and buffered in RAM; jrnSink receives full buffers (append
+// them to a SPIFFS file on a node or a host file on a gateway). A reading is recorded before the alarm transitions it
+// caused. jrnReplay() feeds a journal back through the alarm, aggregate and timeout logic on a copy of the tank table,
+// using the recorded times only, so a replay is deterministic, runs as fast as the CPU allows, leaves the live state
+// alone and reports where the re-derived alarm flags, transitions and timeouts differ from the recorded ones.
+// The tank index is 16 bits, enough for any gateway table; every record carries JRNFORMAT in its type byte, so replay
+// stops at a record written in another format instead of misreading it.
+//
+
+#define JRNBUFFSIZE   256
+#define JRN_MSG       1      // + float level, float volume (the averages if useAvg), uint8 aF
+#define JRN_ALARM     2      // + uint8 alarmType, uint8 raised
+#define JRN_TIMEOUT   3
+#define JRNFORMAT     1      // record format, high nibble of the type byte. Format 0 had a uint8 tank index.
+#define JRNTYPE(b)    ((b) & 0x0F)
+#define JRNHDRSIZE    7      // uint32 ms, uint8 JRNFORMAT << 4 | type, uint16 tank
+#define JRNMAXTANK    0xFFFF
+#define JRNMAXREC     (JRNHDRSIZE + 9)
+
+std::function<void(const byte*, size_t)> jrnSink;   // null = journal off
+byte jrnBuff[JRNBUFFSIZE];
+size_t jrnLen = 0;
+
+void jrnFlush()
+{
+	if (jrnLen > 0 && jrnSink) jrnSink(jrnBuff, jrnLen);
+	jrnLen = 0;
+}
+
+void jrnPut(const void* v, size_t n)
+{
+	const byte* b = (const byte*)v;
+	for (size_t i = 0; i < n; i++) jrnBuff[jrnLen++] = b[i];   // ESP8266 and x86/ARM hosts are all little endian
+}
+
+bool jrnBegin(std::uint8_t type, int t, unsigned long ms)
+{
+	uint32_t ms32 = ms;
+	std::uint8_t tf = (JRNFORMAT << 4) | type;
+	uint16_t t16 = t;
+
+	if (!jrnSink || t < 0 || t > JRNMAXTANK) return(false);
+	if (jrnLen + JRNMAXREC > JRNBUFFSIZE) jrnFlush();
+	jrnPut(&ms32, 4);
+	jrnPut(&tf, 1);
+	jrnPut(&t16, 2);
+	return(true);
+}
+
+// The level and volume the alarms and aggregates were computed from
+
+void jrnMsg(int t, unsigned long ms)
+{
+	if (!jrnBegin(JRN_MSG, t, ms)) return;
+	jrnPut(useAvg ? &tanks[t].liquidDepthAvg : &tanks[t].liquidDepth, 4);
+	jrnPut(useAvg ? &tanks[t].liquidVolumeAvg : &tanks[t].liquidVolume, 4);
+	jrnPut(&tanks[t].alarmFlags, 1);
+}
+
+void jrnAlarm(int t, std::uint8_t alarmType, bool raised, unsigned long ms)
+{
+	std::uint8_t r = raised;
+
+	if (!jrnBegin(JRN_ALARM, t, ms)) return;
+	jrnPut(&alarmType, 1);
+	jrnPut(&r, 1);
+}
+
+void jrnTimeout(int t, unsigned long ms)
+{
+	jrnBegin(JRN_TIMEOUT, t, ms);
+}
+
+struct jrnReplayStats {
+	unsigned long records = 0;
+	unsigned long msgs = 0;
+	unsigned long flagMismatch = 0;      // readings whose recorded alarm flags differ from alarmLevelFlags() now
+	unsigned long alarms = 0;            // transitions delivered to the replay sink
+	unsigned long alarmMismatch = 0;     // recorded transitions the replay did not reproduce
+	unsigned long alarmExtra = 0;        // replayed transitions that were not recorded
+	unsigned long timeouts = 0;          // timeouts re-derived from the replayed messages
+	unsigned long timeoutMismatch = 0;   // recorded timeouts the replay did not reproduce
+	unsigned long bad = 0;               // truncated or unknown records (replay stops)
+};
+
+// Replay a journal against the currently loaded config. tanks[], the aggregates and the alarm sinks are swapped for
+// replay copies (alarms, acks and message times cleared) and restored afterwards; the journal is off meanwhile.
+
+jrnReplayStats jrnReplay(const byte* data, size_t len)
+{
+	jrnReplayStats st;
+	tank* live = tanks;
+	tank* replay = new tank[numtanks];
+	bool* timedOut = new bool[numtanks]();
+	std::uint8_t* pending = new std::uint8_t[numtanks]();   // transitions replayed but not yet matched by a record
+	std::uint8_t* raised = new std::uint8_t[numtanks]();    // alarm state as delivered to the replay sink
+	aggBucket* aggSave = new aggBucket[1 + MAXTANKTYPES + MAXPUMPS];
+	alarmSink* sinkSave = new alarmSink[MAXALARMSINKS];
+	int numAggTypesSave = numAggTypes;
+	int numAggPumpsSave = numAggPumps;
+	int aggTypeOverflowSave = aggTypeOverflow;
+	int aggPumpOverflowSave = aggPumpOverflow;
+	int numAlarmSinksSave = numAlarmSinks;
+	auto jrnSinkSave = jrnSink;
+	size_t p = 0;
+
+	aggSave[0] = aggSiteTotal;
+	for (int i = 0; i < MAXTANKTYPES; i++) aggSave[1 + i] = aggTypes[i];
+	for (int i = 0; i < MAXPUMPS; i++) aggSave[1 + MAXTANKTYPES + i] = aggPumps[i];
+	for (int s = 0; s < MAXALARMSINKS; s++) sinkSave[s] = alarmSinks[s];
+
+	jrnSink = nullptr;   // do not journal the replay itself
+	for (int i = 0; i < numtanks; i++)
+	{
+		replay[i] = live[i];
+		replay[i].alarmFlags = CLEARALARMS;
+		replay[i].alarmFlags_prev = CLEARALARMS;
+		replay[i].alarmAck = CLEARALARMS;
+		replay[i].lastMsgTime = 0;
+	}
+	tanks = replay;
+	aggInit();
+	numAlarmSinks = 0;
+	alarmSubscribe([&](const alarmEvent& ev) {
+		st.alarms++;
+		pending[ev.t] |= ev.alarmType;
+		if (ev.raised) raised[ev.t] |= ev.alarmType;
+		else raised[ev.t] &= ~ev.alarmType;
+		return(true);
+	}, 0, 0);
+
+	while (p + JRNHDRSIZE <= len)
+	{
+		uint32_t ms;
+		uint16_t t;
+		std::uint8_t type;
+
+		memcpy(&ms, data + p, 4);
+		type = JRNTYPE(data[p + 4]);
+		memcpy(&t, data + p + 5, 2);
+		if ((data[p + 4] >> 4) != JRNFORMAT || t >= numtanks)   // older format or another site's journal
+		{
+			st.bad++;
+			break;
+		}
+		p += JRNHDRSIZE;
+		st.records++;
+
+		if (type == JRN_MSG && p + 9 <= len)
+		{
+			tank& tk = tanks[t];
+
+			for (int a = 0; a < NUMALARMS; a++)
+				if (pending[t] & alarmTypeAt(a)) st.alarmExtra++;
+			pending[t] = 0;
+
+			memcpy(&tk.liquidDepth, data + p, 4);
+			memcpy(&tk.liquidVolume, data + p + 4, 4);
+			tk.liquidDepthAvg = tk.liquidDepth;
+			tk.liquidVolumeAvg = tk.liquidVolume;
+			tk.alarmFlags_prev = tk.alarmFlags;
+			tk.alarmFlags = alarmLevelFlags(tk, tk.liquidDepth);
+			if (tk.alarmFlags != data[p + 8]) st.flagMismatch++;
+			tk.lastMsgTime = ms;
+			p += 9;
+			st.msgs++;
+			timedOut[t] = false;
+			aggUpdate(t);
+			alarmCheck(t, ms);
+			while (alarmDispatch(ms) > 0);
+			fcUpdate(t, ms / 1000);
+		}
+		else if (type == JRN_ALARM && p + 2 <= len)
+		{
+			std::uint8_t alarmType = data[p];
+			bool up = data[p + 1] != 0;
+			if ((pending[t] & alarmType) && ((raised[t] & alarmType) != 0) == up) pending[t] &= ~alarmType;
+			else st.alarmMismatch++;
+			p += 2;
+		}
+		else if (type == JRN_TIMEOUT)
+		{
+			if (!(ms - tanks[t].lastMsgTime > tanks[t].timeOut)) st.timeoutMismatch++;
+		}
+		else
+		{
+			st.bad++;
+			break;
+		}
+
+		for (int i = 0; i < numtanks; i++)
+		{
+			if (!tanks[i].ignore && !timedOut[i] && tanks[i].lastMsgTime != 0 && ms - tanks[i].lastMsgTime > tanks[i].timeOut)
+			{
+				timedOut[i] = true;
+				st.timeouts++;
+			}
+		}
+	}
+	if (p < len && st.bad == 0) st.bad++;   // trailing partial record
+	for (int i = 0; i < numtanks; i++)
+		for (int a = 0; a < NUMALARMS; a++)
+			if (pending[i] & alarmTypeAt(a)) st.alarmExtra++;
+
+	tanks = live;
+	aggSiteTotal = aggSave[0];
+	for (int i = 0; i < MAXTANKTYPES; i++) aggTypes[i] = aggSave[1 + i];
+	for (int i = 0; i < MAXPUMPS; i++) aggPumps[i] = aggSave[1 + MAXTANKTYPES + i];
+	numAggTypes = numAggTypesSave;
+	numAggPumps = numAggPumpsSave;
+	aggTypeOverflow = aggTypeOverflowSave;
+	aggPumpOverflow = aggPumpOverflowSave;
+	for (int s = 0; s < MAXALARMSINKS; s++) alarmSinks[s] = sinkSave[s];
+	numAlarmSinks = numAlarmSinksSave;
+	jrnSink = jrnSinkSave;
+
+	delete[] replay;
+	delete[] timedOut;
+	delete[] pending;
+	delete[] raised;
+	delete[] aggSave;
+	delete[] sinkSave;
+	return(st);
+}
+
+//
+// Level history
+//
+// A small ring of (time, level) samples per tank so recent history can be served on request. loadConfig() sizes
+// and allocates it (histInit(), see Memory budget planner), histAdd() per reading (or at whatever interval history should be kept).
+//
+
+#ifndef HISTDEPTH
+#define HISTDEPTH 24
+#endif
+
+struct histSample {
+	uint32_t ts;            // seconds
+	float level;            // liquid depth cm
+};
+
+histSample* histBuff = nullptr;   // numtanks * HISTDEPTH
+std::uint8_t* histHead = nullptr; // next slot per tank
+std::uint8_t* histCount = nullptr;
+
+void histInit()
+{
+	delete[] histBuff;
+	delete[] histHead;
+	delete[] histCount;
+	histBuff = new histSample[numtanks * HISTDEPTH];
+	histHead = new std::uint8_t[numtanks]();
+	histCount = new std::uint8_t[numtanks]();
+}
+
+void histAdd(int t, uint32_t ts)
+{
+	histSample& h = histBuff[t * HISTDEPTH + histHead[t]];
+
+	h.ts = ts;
+	h.level = tanks[t].liquidDepth;
+	histHead[t] = (histHead[t] + 1) % HISTDEPTH;
+	if (histCount[t] < HISTDEPTH) histCount[t]++;
+}
+
+// i = 0 is the oldest sample held
+
+const histSample& histAt(int t, int i)
+{
+	return(histBuff[t * HISTDEPTH + (histHead[t] + HISTDEPTH - histCount[t] + i) % HISTDEPTH]);
+}
+
+//
+// Control topic RPC
+//
+// Requests on mqttTopicCtrl address a node and carry a correlation id that is echoed in the response:
+//
+//   { "n": node, "id": 17, "cmd": "get",  "t": tank }                      -> tank state
+//   { "n": node, "id": 18, "cmd": "hist", "t": tank, "f": from, "to": to } -> [[ts, level], ...] (seconds, at most RPCMAXHIST)
+//   { "n": node, "id": 19, "cmd": "ping", "t": tank }                      -> tank state after the next reading
+//   { "n": node, "id": 20, "cmd": "set",  "t": tank, "lo": f, "hi": f }    -> new alarm levels (factors of depth)
+//   { "n": node, "id": 21, "cmd": "ack",  "t": tank }                      -> acknowledges the tank's current alarms
+//
+// Messages without a command or an id are not requests (responses, pulls) and are ignored. What a node serves depends
+// on rpcRole. A sensor node serves get, hist, ping and set; set is persisted (see Persist Doc Structure) and the next
+// message carries the new static fields. A manager serves get and hist from its copy of the readings and ack, which
+// only exists on the manager. It forwards set to the sensor node it last heard the tank from (the request, readdressed,
+// is the response to publish on the control topic, the sensor node answers the id) and forgets the tank's static
+// fields so the change is pulled in even if that full message is lost. A tank not heard from yet gets RPC_NOROUTE.
+//
+// Responses are { "n", "id", "r" (RPC_OK etc.), ... }. A forced ping cannot answer at once, so it holds one of
+// RPCMAXPENDING slots until rpcOnReading() sees that tank's next reading or RPCTIMEOUT passes; further pings are
+// refused with RPC_BUSY rather than queued without bound.
+//
+
+#define RPCMAXPENDING  4
+#define RPCTIMEOUT     30000L   // ms
+#define RPCMAXHIST     HISTDEPTH
+
+#define RPC_SENSOR     0
+#define RPC_MANAGER    1
+
+#define RPC_OK         0
+#define RPC_BADREQ     1        // malformed, or a command this role does not serve
+#define RPC_BADTANK    2
+#define RPC_BUSY       3
+#define RPC_TIMEOUT    4
+#define RPC_NOROUTE    5        // manager: no node known for the tank
+
+struct rpcPending {
+	bool used;
+	bool done;
+	long id;
+	int t;
+	unsigned long started;
+};
+
+int rpcRole = RPC_SENSOR;
+std::function<void(int)> rpcPingHook;   // start an out of schedule reading of tanks[t]
+rpcPending rpcPend[RPCMAXPENDING];
+
+void rpcTankState(JsonObject resp, int t)
+{
+	resp["t"] = startingTankNum + t;
+	resp["lD"] = tanks[t].liquidDepth;
+	resp["lV"] = tanks[t].liquidVolume;
+	resp["pF"] = tanks[t].percentFull;
+	resp["aF"] = tanks[t].alarmFlags | pumpFaultFlags(t);
+	resp["aA"] = tanks[t].alarmAck;
+	resp["loA"] = tanks[t].loAlarm;
+	resp["hiA"] = tanks[t].hiAlarm;
+}
+
+JsonObject rpcResponse(JsonDocument& resp, const char* node, long id, int result)
+{
+	JsonObject root = resp.to<JsonObject>();
+
+	root["n"] = node;
+	root["id"] = id;
+	root["r"] = result;
+	return(root);
+}
+
+void rpcHist(JsonDocument& req, JsonDocument& resp, const char* node, long id, int t)
+{
+	uint32_t from = req["f"] | 0UL;
+	uint32_t to = req["to"] | 0xFFFFFFFFUL;
+	JsonObject root = rpcResponse(resp, node, id, RPC_OK);
+	JsonArray h = root.createNestedArray("h");
+	int sent = 0;
+
+	for (int i = 0; histBuff != nullptr && i < histCount[t] && sent < RPCMAXHIST; i++)
+	{
+		const histSample& hs = histAt(t, i);
+		if (hs.ts < from || hs.ts > to) continue;
+		JsonArray e = h.createNestedArray();
+		e.add(hs.ts);
+		e.add(hs.level);
+		sent++;
+	}
+}
+
+// Sensor side set: new alarm factors, kept over the config ones across reboots
+
+void rpcSet(JsonDocument& req, JsonDocument& resp, const char* node, long id, int t)
+{
+	float lo = req["lo"] | tanks[t].loAlarmFactor;
+	float hi = req["hi"] | tanks[t].hiAlarmFactor;
+
+	if (!(lo >= 0 && hi <= 2 && lo < hi))
+	{
+		rpcResponse(resp, node, id, RPC_BADREQ);
+		return;
+	}
+	tanks[t].loAlarmFactor = lo;
+	tanks[t].hiAlarmFactor = hi;
+	tanks[t].loAlarm = lo * tanks[t].depth;
+	tanks[t].hiAlarm = hi * tanks[t].depth;
+	tanks[t].alarmSet = true;
+	tanks[t].syncFull = true;   // static fields changed, see delta sync
+	savePersist();
+	rpcTankState(rpcResponse(resp, node, id, RPC_OK), t);
+}
+
+// Manager side set: readdressed to the tank's sensor node
+
+void rpcForwardSet(JsonDocument& req, JsonDocument& resp, const char* node, long id, int t)
+{
+	if (tanks[t].node[0] == 0)
+	{
+		rpcResponse(resp, node, id, RPC_NOROUTE);
+		return;
+	}
+	JsonObject root = resp.to<JsonObject>();
+	root["n"] = (const char*)tanks[t].node;
+	root["id"] = id;
+	root["cmd"] = "set";
+	root["t"] = startingTankNum + t;
+	if (req.containsKey("lo")) root["lo"] = req["lo"];
+	if (req.containsKey("hi")) root["hi"] = req["hi"];
+	shardResync(t);
+}
+
+// Handle a control message. Returns true if resp holds a message to publish now; false if the message was not an
+// RPC for this node or the response is deferred (see rpcPoll).
+
+bool rpcHandle(JsonDocument& req, const char* node, JsonDocument& resp, unsigned long nowMs)
+{
+	const char* n = req["n"];
+	const char* c = req["cmd"];
+	long id = req["id"] | -1L;
+	int t = (req["t"] | -1) - startingTankNum;
+	bool manager = rpcRole == RPC_MANAGER;
+
+	if (n == nullptr || c == nullptr || id < 0 || strcmp(n, node) != 0) return(false);
+	if (t < 0 || t >= numtanks)
+	{
+		rpcResponse(resp, node, id, RPC_BADTANK);
+		return(true);
+	}
+
+	if (strcmp(c, "get") == 0)
+	{
+		rpcTankState(rpcResponse(resp, node, id, RPC_OK), t);
+	}
+	else if (strcmp(c, "hist") == 0)
+	{
+		rpcHist(req, resp, node, id, t);
+	}
+	else if (strcmp(c, "ping") == 0 && !manager)
+	{
+		for (int p = 0; p < RPCMAXPENDING; p++)
+		{
+			if (rpcPend[p].used) continue;
+			rpcPend[p] = { true, false, id, t, nowMs };
+			if (rpcPingHook) rpcPingHook(t);
+			return(false);
+		}
+		rpcResponse(resp, node, id, RPC_BUSY);
+	}
+	else if (strcmp(c, "set") == 0)
+	{
+		if (manager) rpcForwardSet(req, resp, node, id, t);
+		else rpcSet(req, resp, node, id, t);
+	}
+	else if (strcmp(c, "ack") == 0 && manager)
+	{
+		tanks[t].alarmAck = tanks[t].alarmFlags | pumpFaultFlags(t);
+		rpcTankState(rpcResponse(resp, node, id, RPC_OK), t);
+	}
+	else rpcResponse(resp, node, id, RPC_BADREQ);
+
+	return(true);
+}
+
+void rpcOnReading(int t)
+{
+	for (int p = 0; p < RPCMAXPENDING; p++)
+		if (rpcPend[p].used && rpcPend[p].t == t) rpcPend[p].done = true;
+}
+
+// Emit at most one completed or timed out deferred response. Call from loop() until it returns false.
+
+bool rpcPoll(JsonDocument& resp, const char* node, unsigned long nowMs)
+{
+	for (int p = 0; p < RPCMAXPENDING; p++)
+	{
+		if (!rpcPend[p].used) continue;
+		if (rpcPend[p].done) rpcTankState(rpcResponse(resp, node, rpcPend[p].id, RPC_OK), rpcPend[p].t);
+		else if (nowMs - rpcPend[p].started > RPCTIMEOUT) rpcResponse(resp, node, rpcPend[p].id, RPC_TIMEOUT);
+		else continue;
+		rpcPend[p].used = false;
+		return(true);
+	}
+	return(false);
+}
+
+
+//
+// Batch kernels
+//
+// For managers holding thousands of tanks: the per tank conversions and threshold compares done over contiguous float
+// arrays. The loops are branch free with non-aliasing pointers so GCC/Clang vectorise them at -O3 on x86 and ARM
+// gateways; on the ESP8266 the same code simply runs as scalar loops. A depth of 0 marks a slot with nothing to
+// compute (an ignored tank, or a gateway slot no sensor has filled in yet): percent full and flags come out 0.
+//
+// There is no tanks[] version: copying the fields out of class tank and the flags back costs more than the kernels
+// save (bench_batch), so a loop over tanks[] keeps calling alarmLevelFlags(). The kernels are for callers that already
+// hold levels and volumes in arrays.
+//
+
+void batchScale(const float* __restrict in, float* __restrict out, int n, float factor)
+{
+	for (int i = 0; i < n; i++) out[i] = in[i] * factor;
+}
+
+void batchPercentFull(const float* __restrict level, const float* __restrict depth, float* __restrict pct, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float valid = (depth[i] > 0) ? 1.0F : 0.0F;
+		pct[i] = level[i] * 100.0F * valid / (depth[i] + (1.0F - valid));
+	}
+}
+
+void batchAlarmMask(const float* __restrict level, const float* __restrict lo, const float* __restrict hi, const float* __restrict depth, std::uint8_t* __restrict mask, int n)
+{
+	for (int i = 0; i < n; i++)
+		mask[i] = (std::uint8_t)((((level[i] >= hi[i]) ? HIALARM : 0) | ((level[i] <= lo[i]) ? LOALARM : 0) | ((level[i] >= depth[i]) ? MAXDEPTH : 0)) & -(int)(depth[i] > 0));
+}
+
+
+//
+// Pump accounting
+//
+// Tracks each pump's on/off intervals (runtime, cycles) from PumpMon state messages and relates them to the level of
+// the tanks linked to it through pumpNode/pumpNumber. The linked volume comes straight from the manager aggregates
+// (aggUpdate), so every event is O(1) per pump. While a pump runs, the volume change per minute gives its effective flow
+// (smoothed); if after PUMPCHECKTIME the linked level has moved less than PUMPMINFRAC of capacity the pump is flagged
+// as dry running or blocked and a PUMPFAULT alarm is posted for its first linked tank. That catches a failed pump long
+// before the tank drains to the low water alarm. The fault is kept with the pump, not in the tank's alarmFlags (those
+// are redone from the level on every reading); pumpFaultFlags() adds it to the tank's state for the RPC ack.
+//
+
+#define PUMPCHECKTIME   600      // seconds of running before flow is judged
+#define PUMPMINFRAC     0.005F   // level change below 0.5% of linked capacity per PUMPCHECKTIME = no flow
+#define PUMPFLOWALPHA   0.3F
+
+struct pumpState {
+	long pumpNode;
+	int pumpNumber;
+	int tank;                    // first linked tank, used for alarm events
+	bool on;
+	unsigned long onSince;       // seconds
+	unsigned long runtime;       // seconds, completed runs
+	unsigned long cycles;
+	long refVolume;              // linked volume (0.1 L) at refTime
+	unsigned long refTime;
+	float flow;                  // L/minute, smoothed, positive = linked tanks rising
+	bool fault;
+};
+
+pumpState pumps[MAXPUMPS];
+int numPumps = 0;
+
+// Call after aggInit()
+
+void pumpInit()
+{
+	numPumps = 0;
+	for (int t = 0; t < numtanks; t++)
+	{
+		bool found = false;
+		if (tanks[t].pumpNode == 0) continue;
+		for (int p = 0; p < numPumps; p++)
+			if (pumps[p].pumpNode == tanks[t].pumpNode && pumps[p].pumpNumber == tanks[t].pumpNumber) found = true;
+		if (found || numPumps >= MAXPUMPS) continue;
+
+		pumps[numPumps] = pumpState();
+		pumps[numPumps].pumpNode = tanks[t].pumpNode;
+		pumps[numPumps].pumpNumber = tanks[t].pumpNumber;
+		pumps[numPumps].tank = t;
+		numPumps++;
+	}
+}
+
+int pumpFind(long pumpNode, int pumpNumber)
+{
+	for (int p = 0; p < numPumps; p++)
+		if (pumps[p].pumpNode == pumpNode && pumps[p].pumpNumber == pumpNumber) return(p);
+
+	return(-1);
+}
+
+long pumpVolume(int p)
+{
+	aggBucket* b = aggFindPump(pumps[p].pumpNode, pumps[p].pumpNumber, false);
+	return(b == nullptr ? 0 : b->volume);
+}
+
+void pumpSetFault(int p, bool fault)
+{
+	if (pumps[p].fault == fault) return;
+	pumps[p].fault = fault;
+	if (!fault) tanks[pumps[p].tank].alarmAck &= ~PUMPFAULT;
+	alarmPost(pumps[p].tank, PUMPFAULT, fault, millis());   // dispatcher works in millis()
+}
+
+// PUMPFAULT if tanks[t] is the alarm tank of a faulted pump
+
+std::uint8_t pumpFaultFlags(int t)
+{
+	int p = pumpFind(tanks[t].pumpNode, tanks[t].pumpNumber);
+
+	return((p >= 0 && pumps[p].tank == t && pumps[p].fault) ? PUMPFAULT : 0);
+}
+
+// Pump switched on or off (ts in seconds)
+
+void pumpEvent(long pumpNode, int pumpNumber, bool on, unsigned long ts)
+{
+	int p = pumpFind(pumpNode, pumpNumber);
+
+	if (p < 0 || pumps[p].on == on) return;
+	pumps[p].on = on;
+	if (on)
+	{
+		pumps[p].onSince = ts;
+		pumps[p].refVolume = pumpVolume(p);
+		pumps[p].refTime = ts;
+		pumps[p].cycles++;
+	}
+	else
+	{
+		pumps[p].runtime += ts - pumps[p].onSince;
+		pumpSetFault(p, false);
+	}
+}
+
+// A linked tank has a new reading (after aggUpdate(t))
+
+void pumpOnReading(int t, unsigned long ts)
+{
+	int p = pumpFind(tanks[t].pumpNode, tanks[t].pumpNumber);
+	aggBucket* b;
+	long volume;
+
+	if (p < 0 || !pumps[p].on || ts - pumps[p].refTime < PUMPCHECKTIME) return;
+
+	b = aggFindPump(pumps[p].pumpNode, pumps[p].pumpNumber, false);
+	volume = pumpVolume(p);
+	float minutes = (ts - pumps[p].refTime) / 60.0F;
+	float flow = (volume - pumps[p].refVolume) / 10.0F / minutes;
+
+	pumps[p].flow += PUMPFLOWALPHA * (flow - pumps[p].flow);
+	pumpSetFault(p, b != nullptr && labs(volume - pumps[p].refVolume) < PUMPMINFRAC * b->capacity);
+	pumps[p].refVolume = volume;
+	pumps[p].refTime = ts;
+}
+
+unsigned long pumpRuntime(int p, unsigned long ts)
+{
+	return(pumps[p].runtime + (pumps[p].on ? ts - pumps[p].onSince : 0));
+}
+
+/*  JSON Pump Metrics Structure
+  {
+	"pN"        // pump node
+	"pn"        // pump number
+	"on"        // running
+	"rt"        // total runtime, seconds
+	"cy"        // on cycles
+	"fl"        // effective flow, liters (gallons if imperial) per minute
+	"pA"        // PUMPFAULT if dry running/blocked
+  }
+*/
+
+void pumpMsg(JsonDocument& doc, int p, unsigned long ts)
+{
+	doc.clear();
+	doc["pN"] = pumps[p].pumpNode;
+	doc["pn"] = pumps[p].pumpNumber;
+	doc["on"] = pumps[p].on;
+	doc["rt"] = pumpRuntime(p, ts);
+	doc["cy"] = pumps[p].cycles;
+	doc["fl"] = pumps[p].flow * (imperial ? CVTFACTORGALLONS : 1.0F);
+	doc["pA"] = pumps[p].fault ? PUMPFAULT : 0;
+}
+
+//
+// Memory budget planner
+//
+// Buffers and JSON documents are sized from the loaded config rather than fixed worst case guesses: the config doc
+// from the file itself, the message doc from the largest message this site can build (tank, summary, federation delta,
+// history, boot report), the persist doc from numtanks. memPlanAllocate() runs once at the end of loadConfig(), checks
+// the total against free heap less MEMPLANRESERVE (left for WiFi, MQTT and the stack) and fails the load with the
+// numbers if it does not fit. memPlan keeps the sizes for the boot log and for code that writes into the buffers.
+//
+
+#ifndef MEMPLANRESERVE
+#define MEMPLANRESERVE  8192     // bytes of heap kept free after planning
+#endif
+#define MEMPLANSLOTTEXT 24       // serialized bytes allowed per document slot ("key":value,)
+#define MEMPLANSTRINGS  64       // copied strings in a message (node and site names)
+
+// Slots needed to parse json in place: every value is one slot and each one other than the first in its container is
+// preceded by a ','. Commas inside strings are counted too, so this errs high. Strings are not copied (char* input).
+
+size_t memPlanConfigDoc(const byte* json, size_t len)
+{
+	size_t slots = 1;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		if (json[i] == ',' || json[i] == '[' || json[i] == '{') slots++;
+	}
+	memPlan.configBuff = len + 1;
+	memPlan.configDoc = slots * JSON_OBJECT_SIZE(1);
+	return(memPlan.configDoc);
+}
+
+size_t memPlanMsgDoc()
+{
+	size_t tankMsg = JSON_OBJECT_SIZE(NUMMSGKEYS) + MEMPLANSTRINGS;
+	size_t bucket = JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(NUMALARMBITS);
+	size_t summary = JSON_OBJECT_SIZE(8) + JSON_ARRAY_SIZE(NUMALARMBITS) + JSON_ARRAY_SIZE(MAXTANKTYPES) + JSON_ARRAY_SIZE(MAXPUMPS) + JSON_ARRAY_SIZE(2)
+		+ (MAXTANKTYPES + MAXPUMPS) * bucket + MAXTANKTYPES * 2 + MEMPLANSTRINGS;
+	size_t fedDelta = JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(numtanks) + numtanks * JSON_ARRAY_SIZE(3) + MEMPLANSTRINGS;
+	size_t hist = JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(RPCMAXHIST) + RPCMAXHIST * JSON_ARRAY_SIZE(2) + MEMPLANSTRINGS;
+	size_t boot = JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(BOOTMAXPHASES) + BOOTMAXPHASES * (JSON_ARRAY_SIZE(3) + 16) + MEMPLANSTRINGS;
+
+	size_t largest = tankMsg;
+
+	if (summary > largest) largest = summary;
+	if (fedDelta > largest) largest = fedDelta;
+	if (hist > largest) largest = hist;
+	if (boot > largest) largest = boot;
+	return(largest);
+}
+
+void dumpMemPlan()
+{
+	msgn = snprintf(msgbuff, MSGBUFFLEN, "\nMemory plan: cfg %u+%u tanks %u msg %u+%u+%u", (unsigned)memPlan.configBuff,
+		(unsigned)memPlan.configDoc, (unsigned)memPlan.tanks, (unsigned)memPlan.msgDoc, (unsigned)memPlan.msgScratch, (unsigned)memPlan.payload);
+	outputMsg(msgbuff);
+	msgn = snprintf(msgbuff, MSGBUFFLEN, "\npersist %u+%u hist %u total %u",
+		(unsigned)memPlan.persistDoc, (unsigned)memPlan.persistBuff, (unsigned)memPlan.history, (unsigned)memPlan.total);
+	outputMsg(msgbuff);
+	if (memPlan.freeHeap == 0) msgn = snprintf(msgbuff, MSGBUFFLEN, "\nfree heap unknown, budget not checked");
+	else msgn = snprintf(msgbuff, MSGBUFFLEN, "\nfree heap %u headroom %li (reserve %u)", (unsigned)memPlan.freeHeap, memPlan.headroom, (unsigned)MEMPLANRESERVE);
+	outputMsg(msgbuff);
+	dumpFlashTables();
+}
+
+// Size and allocate everything that depends on the config. configBuff, configDoc and tanks are already allocated by
+// loadConfig() and only counted in the total.
+
+bool memPlanAllocate()
+{
+	size_t toAllocate;
+
+	memPlan.tanks = numtanks * sizeof(tank);
+	memPlan.msgDoc = memPlanMsgDoc();
+	memPlan.msgScratch = (msgEncData != ENC_JSON) ? JSON_ARRAY_SIZE(NUMMSGKEYS) + MEMPLANSTRINGS : 0;
+	memPlan.payload = memPlan.msgDoc / JSON_OBJECT_SIZE(1) * MEMPLANSLOTTEXT;
+	memPlan.persistDoc = JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(numtanks) + numtanks * JSON_OBJECT_SIZE(PERSISTTANKKEYS);
+	memPlan.persistBuff = 20 + numtanks * (PERSISTTANKKEYS * MEMPLANSLOTTEXT + 8);   // {"tanklevels":[{"level":n,"calA":n,...},...]}
+	memPlan.history = numtanks * (HISTDEPTH * sizeof(histSample) + 2);
+
+	toAllocate = memPlan.msgDoc + memPlan.msgScratch + memPlan.payload + memPlan.persistDoc + memPlan.persistBuff + memPlan.history;
+	memPlan.total = memPlan.configBuff + memPlan.configDoc + memPlan.tanks + toAllocate;
+	memPlan.freeHeap = bootFreeHeap();
+	memPlan.headroom = (long)memPlan.freeHeap - (long)toAllocate - MEMPLANRESERVE;
+	dumpMemPlan();
+
+	if (memPlan.freeHeap != 0 && memPlan.headroom < 0)
+	{
+		Serial.println(F("Memory plan does not fit, reduce numtanks or config size"));
+		return false;
+	}
+
+	tankmsg = DynamicJsonDocument(memPlan.msgDoc);
+	msgScratch = DynamicJsonDocument(memPlan.msgScratch);
+	delete[] payloadBuff;
+	payloadBuff = new char[memPlan.payload];
+	persistDoc = DynamicJsonDocument(memPlan.persistDoc);
+	delete[] presistBuff;
+	presistBuff = new byte[memPlan.persistBuff];
+	histInit();
+
+	return true;
+}
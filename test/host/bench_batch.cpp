@@ -0,0 +1,95 @@
+//
+// bench_batch.cpp
+//
+// Alarm flags and percent full for a gateway with BENCHTANKS tank slots: a loop over tanks[] calling
+// alarmLevelFlags(), the same with the fields first gathered into arrays for the kernels and the flags written back,
+// and the kernels alone on arrays the caller already holds. Times are ns per tank; test_batch checks the results.
+//
+
+#include "host.h"
+
+#define BENCHTANKS 10000
+#define BENCHREPS  200
+
+volatile float sink;   // keeps the results from being optimised away
+
+std::vector<float> level(BENCHTANKS), depth(BENCHTANKS), lo(BENCHTANKS), hi(BENCHTANKS), pct(BENCHTANKS);
+std::vector<std::uint8_t> mask(BENCHTANKS);
+
+double nsPerTank(std::chrono::steady_clock::time_point start)
+{
+	return(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)BENCHTANKS * BENCHREPS));
+}
+
+void scalarPass()
+{
+	float sum = 0;
+
+	for (int t = 0; t < numtanks; t++)
+	{
+		tank& tk = tanks[t];
+		if (tk.ignore || tk.depth == 0) continue;
+		float lvl = useAvg ? tk.liquidDepthAvg : tk.liquidDepth;
+		sum += lvl * 100.0F / tk.depth;
+		tk.alarmFlags = alarmLevelFlags(tk, lvl);
+	}
+	sink = sum;
+}
+
+void kernelPass()
+{
+	batchPercentFull(level.data(), depth.data(), pct.data(), numtanks);
+	batchAlarmMask(level.data(), lo.data(), hi.data(), depth.data(), mask.data(), numtanks);
+	sink = pct[numtanks / 2];
+}
+
+void gatherPass()
+{
+	for (int t = 0; t < numtanks; t++)
+	{
+		const tank& tk = tanks[t];
+		level[t] = useAvg ? tk.liquidDepthAvg : tk.liquidDepth;
+		depth[t] = tk.ignore ? 0 : tk.depth;
+		lo[t] = tk.loAlarm;
+		hi[t] = tk.hiAlarm;
+	}
+	kernelPass();
+	for (int t = 0; t < numtanks; t++)
+		if (depth[t] > 0) tanks[t].alarmFlags = mask[t];
+}
+
+int main()
+{
+	if (!hostLoadConfig(hostConfig(1))) return(1);
+	if (!shardInit(BENCHTANKS)) return(1);
+
+	randomSeed(43);
+	for (int t = 0; t < numtanks; t++)
+	{
+		tank& tk = tanks[t];
+		tk.ignore = false;
+		tk.depth = random(50, 400);
+		tk.loAlarm = tk.depth * random(5, 30) / 100.0F;
+		tk.hiAlarm = tk.depth * random(80, 110) / 100.0F;
+		tk.liquidDepth = random(0, (long)tk.depth * 110) / 100.0F;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < BENCHREPS; r++) scalarPass();
+	double scalarNs = nsPerTank(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < BENCHREPS; r++) gatherPass();
+	double gatherNs = nsPerTank(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < BENCHREPS; r++) kernelPass();
+	double kernelNs = nsPerTank(start);
+
+	printf("batch kernels, %i tanks x %i\n", BENCHTANKS, BENCHREPS);
+	printf("path                   ns/tank  speedup\n");
+	printf("tanks[] loop           %7.2f  %7.2f\n", scalarNs, 1.0);
+	printf("gather + kernels       %7.2f  %7.2f\n", gatherNs, scalarNs / gatherNs);
+	printf("kernels only           %7.2f  %7.2f\n", kernelNs, scalarNs / kernelNs);
+	return(0);
+}
@@ -0,0 +1,92 @@
+//
+// bench_encoding.cpp
+//
+// Size and CPU cost of the tank message encodings. Messages are built with syncTankMsg() into tankmsg/payloadBuff as
+// sized by memPlanAllocate() for a one tank node, so an encoding that does not fit the device buffers fails here too.
+// Times are host nanoseconds and only meaningful relative to ENC_JSON; the sizes are what goes over the air.
+//
+
+#include "host.h"
+
+#define BENCHMSGS 20000
+#define BENCHREPS 5
+
+const char* const encNames[] = { "json", "jsonpos", "msgpack" };
+
+struct encResult {
+	size_t bytes = 0;
+	double encodeNs = 0;
+	double decodeNs = 0;
+	bool ok = true;
+};
+
+double nsSince(std::chrono::steady_clock::time_point start)
+{
+	return(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+}
+
+encResult run(int enc, bool full)
+{
+	DynamicJsonDocument scratch(tankmsg.capacity());
+	DynamicJsonDocument decoded(tankmsg.capacity());
+	std::vector<tank> readings(BENCHMSGS, tanks[0]);
+	std::vector<std::string> encoded;
+	encResult r;
+
+	randomSeed(34);
+	for (auto& tk : readings)
+	{
+		tk.liquidDepth = random(1000, 20000) / 100.0F;
+		tk.liquidDepthAvg = tk.liquidDepth + random(-100, 100) / 100.0F;
+		tk.liquidVolume = tk.liquidDepth * tk.vCM;
+		tk.liquidVolumeAvg = tk.liquidDepthAvg * tk.vCM;
+		tk.percentFull = tk.liquidDepth * 100 / tk.depth;
+	}
+
+	for (int rep = 0; rep < BENCHREPS; rep++)
+	{
+		encoded.clear();
+		auto start = std::chrono::steady_clock::now();
+		for (auto& tk : readings)
+		{
+			tk.syncFull = full;
+			syncTankMsg(tankmsg, "tanksmon-pumphouse", tk, 1);
+			size_t len = msgEncode(tankmsg, enc, payloadBuff, memPlan.payload, scratch);
+			if (len == 0) r.ok = false;
+			encoded.push_back(std::string(payloadBuff, len));
+		}
+		r.encodeNs += nsSince(start);
+
+		start = std::chrono::steady_clock::now();
+		for (auto& m : encoded)
+			if (!msgDecode(m.data(), m.size(), decoded, scratch)) r.ok = false;
+		r.decodeNs += nsSince(start);
+	}
+	for (auto& m : encoded) r.bytes += m.size();
+	r.bytes /= BENCHMSGS;
+	r.encodeNs /= (double)BENCHMSGS * BENCHREPS;
+	r.decodeNs /= (double)BENCHMSGS * BENCHREPS;
+	return(r);
+}
+
+int main()
+{
+	if (!hostLoadConfig(hostConfig(1))) return(1);
+
+	printf("tank message encodings, %i messages x %i, msgDoc %u B, payload buffer %u B\n", BENCHMSGS, BENCHREPS, (unsigned)memPlan.msgDoc,
+		(unsigned)memPlan.payload);
+	printf("message  encoding  bytes  vs json  encode ns  decode ns  vs json (enc+dec)\n");
+	for (int full = 1; full >= 0; full--)
+	{
+		encResult base;
+		for (int enc = ENC_JSON; enc <= ENC_MSGPACK; enc++)
+		{
+			encResult r = run(enc, full);
+			if (enc == ENC_JSON) base = r;
+			printf("%-7s  %-8s  %5u  %6.0f%%  %9.0f  %9.0f  %6.2f%s\n", full ? "full" : "delta", encNames[enc], (unsigned)r.bytes,
+				100.0 * r.bytes / base.bytes, r.encodeNs, r.decodeNs, (r.encodeNs + r.decodeNs) / (base.encodeNs + base.decodeNs),
+				r.ok ? "" : "  OVERFLOW");
+		}
+	}
+	return(0);
+}
@@ -0,0 +1,87 @@
+//
+// bench_shard.cpp
+//
+// Sharded ingest throughput against the number of worker threads. A gateway with BENCHTANKS tank slots is fed
+// pre-encoded keyed JSON messages by a producer thread; W workers drain the NUMSHARDS shards between them and this
+// thread runs shardCollect(). Reports messages/s end to end for W = 1, 2, 4, 8.
+//
+
+#define NUMSHARDS 8
+#include "host.h"
+#include <thread>
+
+#define BENCHTANKS 4096
+#define BENCHMSGS  200000
+
+std::vector<std::string> msgs;
+
+double run(int numWorkers)
+{
+	std::atomic<bool> stop{ false };
+	std::vector<std::thread> workers;
+	int collected = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int w = 0; w < numWorkers; w++)
+	{
+		workers.push_back(std::thread([w, numWorkers, &stop]() {
+			while (!stop)
+			{
+				int n = 0;
+				for (int s = w; s < NUMSHARDS; s += numWorkers) n += shardDrain(s);
+				if (n == 0) std::this_thread::yield();
+			}
+		}));
+	}
+	std::thread producer([]() {
+		for (size_t i = 0; i < msgs.size(); )
+		{
+			if (shardPush(msgs[i].data(), msgs[i].size(), i, i / 10)) i++;
+			else std::this_thread::yield();
+		}
+	});
+	while (collected < (int)msgs.size()) collected += shardCollect();
+	producer.join();
+	stop = true;
+	for (auto& w : workers) w.join();
+
+	return(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+int main()
+{
+	DynamicJsonDocument doc(1024);
+	char payload[SHARDMSGSIZE];
+	double base = 0;
+
+	if (!hostLoadConfig(hostConfig(1))) return(1);
+	if (!shardInit(BENCHTANKS)) return(1);
+	aggInit();
+
+	randomSeed(29);
+	for (int i = 0; i < BENCHMSGS; i++)
+	{
+		tank sensor;
+		sensor.depth = 200;
+		sensor.vCM = 10;
+		sensor.loAlarm = 20;
+		sensor.hiAlarm = 180;
+		sensor.liquidDepth = random(1, 200);
+		sensor.liquidVolume = sensor.liquidDepth * sensor.vCM;
+		sensor.syncFull = (i < BENCHTANKS);   // first pass registers every tank
+		syncTankMsg(doc, "gw-node", sensor, startingTankNum + i % BENCHTANKS);
+		msgs.push_back(std::string(payload, serializeJson(doc, payload, sizeof(payload))));
+	}
+	run(1);   // registration pass, not timed
+
+	printf("shard ingest, %i tanks, %i shards, %i messages\n", BENCHTANKS, NUMSHARDS, BENCHMSGS);
+	printf("workers  msgs/s      speedup\n");
+	for (int w = 1; w <= 8; w *= 2)
+	{
+		double secs = run(w);
+		if (w == 1) base = secs;
+		printf("%7i  %10.0f  %6.2f\n", w, BENCHMSGS / secs, base / secs);
+	}
+	printf("(%u hardware threads; the producer and shardCollect() each hold one)\n", std::thread::hardware_concurrency());
+	return(0);
+}
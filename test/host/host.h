@@ -0,0 +1,118 @@
+//
+// host.h
+//
+// Host test harness. Defines the globals a sketch normally provides, includes Tanksmon.h against the stubs and adds the
+// CHECK macros and config helpers shared by the tests, benchmarks and tools in this directory.
+//
+
+#pragma once
+
+#include "Arduino.h"
+#include <string>
+#include <vector>
+
+// Sketch side globals
+
+bool debug = false;
+const char* pssid = "";
+const char* ppwd = "";
+const char* assid = "";
+const char* apwd = "";
+bool wifiTryAlt = false;
+int timeZone = 0;
+const char* mqttTopicData = "tanksmon/data";
+const char* mqttTopicCtrl = "tanksmon/ctrl";
+const char* mqttUid = "";
+const char* mqttPwd = "";
+const char* otaPwd = "";
+
+#define MSGBUFFLEN 80
+char msgbuff[MSGBUFFLEN];
+int msgn = 0;
+
+void outputMsg(const char* msg)
+{
+	if (hostVerbose) fputs(msg, stdout);
+}
+
+// Heap model, for tests that define TANKSMON_HOSTHEAP as hostFreeHeap before including this file. Every live
+// allocation through operator new counts against hostHeapSize, and what is left is what bootFreeHeap() and the memory
+// planner see. ArduinoJson allocates with malloc and is not counted.
+
+#ifdef TANKSMON_HOSTHEAP
+#include <new>
+
+size_t hostHeapSize = 81920;   // ESP8266 data RAM
+long hostHeapUsed = 0;
+
+void* operator new(size_t n)
+{
+	size_t* p = (size_t*)malloc(n + 2 * sizeof(size_t));
+	if (p == nullptr) throw std::bad_alloc();
+	p[0] = n;
+	hostHeapUsed += n;
+	return(p + 2);
+}
+
+void operator delete(void* p) noexcept
+{
+	if (p == nullptr) return;
+	size_t* h = (size_t*)p - 2;
+	hostHeapUsed -= h[0];
+	free(h);
+}
+
+void* operator new[](size_t n) { return(operator new(n)); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+uint32_t hostFreeHeap()
+{
+	long f = (long)hostHeapSize - hostHeapUsed;
+
+	return(f < 1 ? 1 : f);   // never 0, which reads as unknown
+}
+#endif
+
+#include "Tanksmon.h"
+
+// Checks, a failed check is reported and counted but does not stop the test
+
+int hostChecks = 0;
+int hostFails = 0;
+
+#define CHECK(c) do { hostChecks++; if (!(c)) { hostFails++; printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #c); } } while (0)
+#define CHECKNEAR(a, b, eps) do { hostChecks++; double a_ = (a), b_ = (b); if (!(fabs(a_ - b_) <= (eps))) { hostFails++; printf("%s:%d: CHECKNEAR(%s, %s) failed: %g vs %g\n", __FILE__, __LINE__, #a, #b, a_, b_); } } while (0)
+
+int hostReport(const char* name)
+{
+	printf("%-16s %5i checks, %i failed\n", name, hostChecks, hostFails);
+	return(hostFails ? 1 : 0);
+}
+
+// A valid config with n tanks of depth 200 cm, vCM 10 L/cm. extraSite/extraTank are spliced into every site/tank
+// object (e.g. "\"imperial\":true,").
+
+std::string hostConfig(int n, const std::string& extraSite = "", const std::string& extraTank = "")
+{
+	std::string s = "{\"site\":{" + extraSite + "\"numtanks\":" + std::to_string(n) +
+		",\"startingTankNum\":1,\"sitename\":\"host\",\"pssid\":\"ssid\",\"mqtt_topic_data\":\"tanksmon/data\"},\"tankdefs\":[";
+
+	for (int t = 0; t < n; t++)
+	{
+		if (t) s += ",";
+		s += "{" + extraTank + "\"tankType\":\"W\",\"depth\":200,\"vCM\":10,\"timeout\":60,\"sensorOffset\":20,\"pumpnode\":" +
+			std::to_string(t / 2 + 1) + ",\"pumpnumber\":" + std::to_string(t % 2 + 1) + "}";
+	}
+	return(s + "]}");
+}
+
+// Fresh flash holding only the plain config file, then loadConfig()
+
+bool hostLoadConfig(const std::string& json)
+{
+	hostFsReset();
+	hostFsPut(TANKSMONCFGFILE, json);
+	return(loadConfig());
+}
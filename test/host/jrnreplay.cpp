@@ -0,0 +1,64 @@
+//
+// jrnreplay.cpp
+//
+// Replays an event journal (see Event journal and replay in Tanksmon.h) against a config file and prints where the
+// re-derived alarms and timeouts differ from the recorded ones. With reps > 1 the replay is repeated and timed, which
+// makes a recorded journal a benchmark on real traffic.
+//
+//   jrnreplay config.json journal.bin [reps]
+//
+
+#include "host.h"
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+bool readFile(const char* path, std::string& out)
+{
+	std::ifstream f(path, std::ios::binary);
+
+	if (!f) return(false);
+	out.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+	return(true);
+}
+
+int main(int argc, char** argv)
+{
+	std::string cfg, jrn;
+	int reps = 1;
+
+	if (argc > 3) reps = atoi(argv[3]);
+	if (argc < 3 || reps < 1)
+	{
+		printf("usage: jrnreplay config.json journal.bin [reps]\n");
+		return(1);
+	}
+	if (!readFile(argv[1], cfg) || !hostLoadConfig(cfg))
+	{
+		printf("%s: cannot load config\n", argv[1]);
+		return(1);
+	}
+	if (!readFile(argv[2], jrn))
+	{
+		printf("%s: cannot read journal\n", argv[2]);
+		return(1);
+	}
+	aggInit();
+
+	jrnReplayStats st;
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < reps; r++) st = jrnReplay((const byte*)jrn.data(), jrn.size());
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%s: %lu records, %lu readings, %u tanks\n", argv[2], st.records, st.msgs, (unsigned)numtanks);
+	printf("alarm flags differing from the config    %lu\n", st.flagMismatch);
+	printf("alarm transitions replayed               %lu\n", st.alarms);
+	printf("  recorded but not replayed              %lu\n", st.alarmMismatch);
+	printf("  replayed but not recorded              %lu\n", st.alarmExtra);
+	printf("timeouts replayed                        %lu\n", st.timeouts);
+	printf("  recorded but not replayed              %lu\n", st.timeoutMismatch);
+	if (st.bad) printf("replay stopped at a bad or truncated record\n");
+	printf("%.0f records/s (%i reps)\n", secs > 0 ? st.records * (double)reps / secs : 0.0, reps);
+
+	return(st.bad || st.flagMismatch || st.alarmMismatch || st.alarmExtra || st.timeoutMismatch ? 2 : 0);
+}
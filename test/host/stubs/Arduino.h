@@ -0,0 +1,89 @@
+//
+// Arduino.h (host stub)
+//
+// Just enough of the ESP8266 Arduino core for Tanksmon.h to build and run on a PC. ARDUINO is deliberately not defined,
+// Tanksmon.h then maps its PROGMEM helpers to the plain ones and ArduinoJson builds without the Arduino String/Stream
+// support.
+//
+// The clock is manual by default: millis()/micros() only move when a test calls hostAdvance() (or delay()), so
+// timeouts, backoff and rate limits are deterministic. Set hostRealClock for benchmarks and the boot profiler.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+
+typedef uint8_t byte;
+
+inline bool hostRealClock = false;
+inline uint64_t hostClockUs = 0;
+inline bool hostVerbose = false;     // echo Serial/outputMsg to stdout
+inline std::mt19937 hostRng(1);
+
+inline uint64_t hostMicros()
+{
+	static const auto start = std::chrono::steady_clock::now();
+
+	if (!hostRealClock) return(hostClockUs);
+	return((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() + hostClockUs);
+}
+
+inline void hostAdvance(unsigned long ms) { hostClockUs += (uint64_t)ms * 1000; }
+
+inline unsigned long millis() { return((unsigned long)(hostMicros() / 1000)); }
+inline unsigned long micros() { return((unsigned long)hostMicros()); }
+inline void delay(unsigned long ms) { hostAdvance(ms); }
+inline void yield() {}
+
+inline void randomSeed(unsigned long seed) { hostRng.seed(seed); }
+
+inline long random(long howsmall, long howbig)
+{
+	if (howsmall >= howbig) return(howsmall);
+	return(std::uniform_int_distribution<long>(howsmall, howbig - 1)(hostRng));
+}
+
+inline long random(long howbig) { return(random(0, howbig)); }
+
+class HostSerial {
+public:
+	void begin(unsigned long) {}
+	void flush() { if (hostVerbose) fflush(stdout); }
+
+	template <typename T> size_t print(const T& v)
+	{
+		std::ostringstream s;
+		s << v;
+		return(out(s.str()));
+	}
+	size_t print(float v, int digits = 2) { return(print((double)v, digits)); }
+	size_t print(double v, int digits = 2)
+	{
+		char b[48];
+		snprintf(b, sizeof(b), "%.*f", digits, v);
+		return(out(b));
+	}
+	size_t print(uint8_t v) { return(print((unsigned)v)); }
+	template <typename T> size_t println(const T& v) { return(print(v) + println()); }
+	size_t println() { return(out("\n")); }
+
+private:
+	size_t out(const std::string& s)
+	{
+		if (hostVerbose) fputs(s.c_str(), stdout);
+		return(s.size());
+	}
+};
+
+inline HostSerial Serial;
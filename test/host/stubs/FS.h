@@ -0,0 +1,133 @@
+//
+// FS.h (host stub)
+//
+// In memory SPIFFS. Files live in hostFiles (path -> bytes) so a test can seed, inspect or corrupt them directly.
+//
+// Power loss: hostFsOpsLeft counts the mutating operations (open for write, write, remove, rename) still allowed.
+// When it reaches 0 the flash is "off": the failing write stores only the first half of its data and every later
+// mutation fails. A test then clears hostFsOpsLeft (-1 = unlimited) and "reboots" by loading again.
+//
+
+#pragma once
+
+#include "Arduino.h"
+#include <map>
+#include <memory>
+#include <vector>
+
+inline std::map<std::string, std::vector<byte>> hostFiles;
+inline long hostFsOpsLeft = -1;
+inline bool hostFsMountFails = false;
+
+inline bool hostFsOp()
+{
+	if (hostFsOpsLeft < 0) return(true);
+	if (hostFsOpsLeft == 0) return(false);
+	hostFsOpsLeft--;
+	return(true);
+}
+
+inline void hostFsReset()
+{
+	hostFiles.clear();
+	hostFsOpsLeft = -1;
+	hostFsMountFails = false;
+}
+
+inline void hostFsPut(const char* path, const std::string& data)
+{
+	hostFiles[path] = std::vector<byte>(data.begin(), data.end());
+}
+
+class File {
+public:
+	File() {}
+	File(const std::string& path, bool writable) : path(path), writable(writable), valid(true) {}
+
+	explicit operator bool() const { return(valid && hostFiles.count(path) > 0); }
+	size_t size() const { return(*this ? hostFiles[path].size() : 0); }
+	int available() const { return((int)(size() - pos)); }
+	bool seek(uint32_t p)
+	{
+		if (!*this || p > size()) return(false);
+		pos = p;
+		return(true);
+	}
+
+	size_t read(uint8_t* buff, size_t len)
+	{
+		if (!*this) return(0);
+		std::vector<byte>& d = hostFiles[path];
+		size_t n = (pos < d.size()) ? d.size() - pos : 0;
+		if (n > len) n = len;
+		if (n) memcpy(buff, d.data() + pos, n);
+		pos += n;
+		return(n);
+	}
+
+	size_t write(const uint8_t* buff, size_t len)
+	{
+		if (!*this || !writable) return(0);
+		bool ok = hostFsOp();
+		size_t n = ok ? len : len / 2;   // torn write on power loss
+		std::vector<byte>& d = hostFiles[path];
+		if (d.size() < pos + n) d.resize(pos + n);
+		if (n) memcpy(d.data() + pos, buff, n);
+		pos += n;
+		if (!ok) hostFsOpsLeft = 0;
+		return(ok ? len : 0);
+	}
+
+	size_t print(const char* s) { return(write((const uint8_t*)s, strlen(s))); }
+	void flush() {}
+	void close() { valid = false; }
+
+private:
+	std::string path;
+	size_t pos = 0;
+	bool writable = false;
+	bool valid = false;
+};
+
+class HostFS {
+public:
+	bool begin() { return(!hostFsMountFails); }
+	bool exists(const char* path) { return(hostFiles.count(path) > 0); }
+
+	File open(const char* path, const char* mode)
+	{
+		bool write = strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+');
+
+		if (mode[0] == 'r' && !exists(path)) return(File());
+		if (mode[0] == 'w')
+		{
+			if (!hostFsOp()) return(File());
+			hostFiles[path].clear();
+		}
+		else if (mode[0] == 'a' && !exists(path))
+		{
+			if (!hostFsOp()) return(File());
+			hostFiles[path];
+		}
+		File f(path, write);
+		if (mode[0] == 'a') f.seek(f.size());
+		return(f);
+	}
+
+	bool remove(const char* path)
+	{
+		if (!exists(path) || !hostFsOp()) return(false);
+		hostFiles.erase(path);
+		return(true);
+	}
+
+	bool rename(const char* from, const char* to)
+	{
+		if (!exists(from) || exists(to) || !hostFsOp()) return(false);   // SPIFFS does not replace an existing file
+		hostFiles[to] = hostFiles[from];
+		hostFiles.erase(from);
+		return(true);
+	}
+};
+
+inline HostFS SPIFFS;
@@ -0,0 +1,20 @@
+//
+// TimeLib.h (host stub)
+//
+
+#pragma once
+
+#include "Arduino.h"
+
+#define SECS_PER_MIN  60UL
+#define SECS_PER_HOUR 3600UL
+#define SECS_PER_DAY  86400UL
+
+typedef time_t(*getExternalTime)();
+
+inline time_t hostTimeNow = 0;
+
+inline time_t now() { return(hostTimeNow); }
+inline void setTime(time_t t) { hostTimeNow = t; }
+inline void setSyncProvider(getExternalTime f) { if (f) hostTimeNow = f(); }
+inline void setSyncInterval(time_t) {}
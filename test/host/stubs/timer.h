@@ -0,0 +1,28 @@
+//
+// timer.h (host stub), Tanksmon.h includes it for the sketches but does not use it
+//
+
+#pragma once
+
+#include "Arduino.h"
+
+class Timer {
+public:
+	void setInterval(unsigned long ms) { interval = ms; }
+	void setCallback(void (*cb)()) { callback = cb; }
+	void start() { last = millis(); running = true; }
+	void stop() { running = false; }
+	void update()
+	{
+		if (running && callback && millis() - last >= interval)
+		{
+			last = millis();
+			callback();
+		}
+	}
+
+private:
+	unsigned long interval = 0, last = 0;
+	void (*callback)() = nullptr;
+	bool running = false;
+};
@@ -0,0 +1,112 @@
+//
+// tanksim.cpp
+//
+// Manager sizing run: a simulated sensor fleet (tanksim.h) feeds the sharded ingest of an in-process gateway, W worker
+// threads drain the shards (0 = drained inline on this thread) and this thread collects and dispatches alarms. The
+// fleet's curves run on the simulated clock, so a day of sensor traffic takes seconds; ingest latency is real time.
+//
+//   tanksim [nodes [tanksPerNode [hours [workers [encoding]]]]]
+//
+
+#include "tanksim.h"
+#include <thread>
+
+#define SIMSTEPMS 1000UL
+#define SIMPUSHWAITUS 100000ULL   // real time a publish waits on a full shard before the broker refuses it
+#define SIMIDLEUS 500000ULL       // final drain gives up after this long without progress
+
+int numWorkers = 0;
+
+// Stands in for the broker: a full shard queue holds the publish back until the manager has caught up, for at most
+// SIMPUSHWAITUS. A message the shards never take (too long, no tank number, still full) is refused.
+
+bool ingest(const char* payload, size_t len)
+{
+	uint64_t until = simRealUs() + SIMPUSHWAITUS;
+
+	while (!shardPush(payload, len, millis(), millis() / 1000))
+	{
+		if (simRealUs() > until) return(false);
+		if (numWorkers == 0)
+			for (int s = 0; s < NUMSHARDS; s++) shardDrain(s);
+		if (shardCollect() == 0) std::this_thread::yield();
+	}
+	return(true);
+}
+
+int main(int argc, char** argv)
+{
+	simConfig cfg;
+	float hours = 6;
+	std::atomic<bool> stop{ false };
+	std::vector<std::thread> workers;
+
+	cfg.numNodes = 50;
+	if (argc > 1) cfg.numNodes = atoi(argv[1]);
+	if (argc > 2) cfg.tanksPerNode = atoi(argv[2]);
+	if (argc > 3) hours = atof(argv[3]);
+	if (argc > 4) numWorkers = atoi(argv[4]);
+	if (argc > 5) cfg.encoding = atoi(argv[5]);
+	if (cfg.numNodes < 1 || cfg.tanksPerNode < 1 || hours <= 0 || numWorkers < 0 || cfg.encoding < ENC_JSON || cfg.encoding > ENC_MSGPACK)
+	{
+		printf("usage: tanksim [nodes [tanksPerNode [hours [workers [encoding 0-%i]]]]]\n", ENC_MSGPACK);
+		return(1);
+	}
+
+	if (!hostLoadConfig(hostConfig(1))) return(1);
+	if (!shardInit(cfg.numNodes * cfg.tanksPerNode)) return(1);
+	aggInit();
+	pumpInit();
+	shardPullHook = [](const char* node, int tankNum) { simPull(tankNum); };
+	shardReadingHook = [](int t) { simOnIngest(t); };
+	int sink = alarmSubscribe([](const alarmEvent& ev) { simOnAlarm(ev.t, ev.alarmType, ev.raised, millis()); return(true); }, 0, 0);
+
+	simSetup(cfg, ingest, millis());
+
+	for (int w = 0; w < numWorkers; w++)
+	{
+		workers.push_back(std::thread([w, &stop]() {
+			while (!stop)
+			{
+				int n = 0;
+				for (int s = w; s < NUMSHARDS; s += numWorkers) n += shardDrain(s);
+				if (n == 0) std::this_thread::yield();
+			}
+		}));
+	}
+
+	uint64_t start = simRealUs();
+	unsigned long endMs = millis() + (unsigned long)(hours * 3600000.0F);
+	while ((long)(millis() - endMs) < 0)
+	{
+		hostAdvance(SIMSTEPMS);
+		simTick(millis());
+		if (numWorkers == 0)
+			for (int s = 0; s < NUMSHARDS; s++) shardDrain(s);
+		shardCollect();
+		while (alarmDispatch(millis()) > 0);   // loop() runs many times per simulated step
+	}
+
+	// let what is still queued come through; rejected messages never arrive, so stop once nothing moves
+	uint64_t idleSince = simRealUs();
+	while (simStats.received < simStats.sent - simStats.refused && simRealUs() - idleSince < SIMIDLEUS)
+	{
+		if (numWorkers == 0)
+			for (int s = 0; s < NUMSHARDS; s++) shardDrain(s);
+		if (shardCollect() > 0) idleSince = simRealUs();
+		else std::this_thread::yield();
+	}
+	while (alarmDispatch(millis()) > 0);
+	stop = true;
+	for (auto& w : workers) w.join();
+	for (int s = 0; s < NUMSHARDS; s++) simStats.rejected += shards[s].rejected;
+	double secs = (simRealUs() - start) / 1e6;
+
+	printf("%i nodes x %i tanks, %.1f simulated hours, %i workers, encoding %i, %i shards\n", cfg.numNodes, cfg.tanksPerNode, hours,
+		numWorkers, cfg.encoding, NUMSHARDS);
+	simReport();
+	printf("alarm sink coalesced=%lu dropped=%lu\n", alarmSinks[sink].coalesced, alarmSinks[sink].dropped);
+	printf("%.2f s real, %.0f msgs/s\n", secs, simStats.received / secs);
+	simFree();
+	return(0);
+}
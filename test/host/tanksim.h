@@ -0,0 +1,268 @@
+//
+// tanksim.h
+//
+// Sensor node simulator. Stands in for a fleet of sensor nodes when sizing a manager. Each simulated node owns
+// tanksPerNode tanks modelled with class tank; levels follow a drain/refill sawtooth plus sonar noise and messages are
+// built with syncTankMsg()/msgEncode() exactly as a node sends them, then handed to simSend (the in-process shard
+// ingest in tanksim.cpp, or a publish to a local broker). Nodes can drop messages and deep sleep between sends.
+// The manager side reports back through simOnIngest()/simOnAlarm() so ingest latency, loss and alarm reaction time can
+// be read from simStats. Loss is every sent message that never reached simOnIngest(): refused by the transport, rejected
+// by the manager or still queued when the run ends.
+//
+// Simulated tank t is tank number startingTankNum + t on the manager, so manager tank index == simulator index.
+// Time is passed in: nowMs is the simulated clock that drives the level curves and send schedule, latency is measured
+// on the real clock.
+//
+
+#pragma once
+
+#include "host.h"
+#include <deque>
+
+#define SIMPAYLOADSIZE SHARDMSGSIZE
+
+struct simConfig {
+	int numNodes = 4;
+	int tanksPerNode = 4;
+	float depth = 200.0F;             // cm
+	float vCM = 10.0F;                // L/cm
+	float sonarOffset = 20.0F;        // cm
+	float loAlarmFactor = 0.10F;
+	float hiAlarmFactor = 0.90F;
+	float drainRate = 5.0F;           // cm/hour
+	float fillRate = 60.0F;           // cm/hour while refilling
+	float noise = 1.0F;               // +/- cm of sonar noise
+	int dropoutPct = 2;               // percent of messages never sent
+	unsigned long sendDelay = 5000L;  // ms between messages from an awake node
+	unsigned long sleepDelay = 0L;    // ms of deep sleep after each send, 0 = always awake
+	float maxRate = 100.0F;           // messages/second across all nodes
+	int encoding = ENC_JSON;          // msgEncode() encoding
+	unsigned long seed = 30;
+};
+
+struct simStatsT {
+	unsigned long sent = 0;
+	unsigned long droppedBySim = 0;   // dropouts and rate limited sends, not counted as loss
+	unsigned long refused = 0;        // transport refused the message (shard queue full, too long, no tank number)
+	unsigned long rejected = 0;       // accepted, then dropped by the manager (undecodable, tank outside the table)
+	unsigned long received = 0;
+	uint64_t latencySum = 0;          // us, real clock
+	uint64_t latencyMax = 0;
+	unsigned long alarms = 0;
+	uint64_t alarmReactionSum = 0;    // ms of simulated time from level crossing to manager alarm
+	uint64_t alarmReactionMax = 0;
+};
+
+simConfig simCfg;
+simStatsT simStats;
+tank* simTanks = nullptr;
+bool* simFilling = nullptr;
+unsigned long* simAlarmSince = nullptr;  // ms the simulated level entered alarm, 0 = nothing pending
+std::uint8_t* simLevelFlags = nullptr;   // alarm flags of the true (noise free) level
+std::uint8_t* simMgrFlags = nullptr;     // alarms the manager has raised and not cleared
+unsigned long* simNextSend = nullptr;    // per node
+std::deque<uint64_t>* simInFlight = nullptr;   // per tank, real clock us of messages not yet ingested
+unsigned long simLastTick = 0L;
+float simTokens = 0;
+std::mt19937 simRng;
+std::function<bool(const char*, size_t)> simSend;   // false = not accepted
+
+int simRandom(int lo, int hi)
+{
+	return(std::uniform_int_distribution<int>(lo, hi - 1)(simRng));
+}
+
+uint64_t simRealUs()
+{
+	static const auto start = std::chrono::steady_clock::now();
+
+	return((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+int simNumTanks()
+{
+	return(simCfg.numNodes * simCfg.tanksPerNode);
+}
+
+void simFree()
+{
+	delete[] simTanks;
+	delete[] simFilling;
+	delete[] simAlarmSince;
+	delete[] simLevelFlags;
+	delete[] simMgrFlags;
+	delete[] simNextSend;
+	delete[] simInFlight;
+	simTanks = nullptr;
+	simFilling = nullptr;
+	simAlarmSince = nullptr;
+	simLevelFlags = nullptr;
+	simMgrFlags = nullptr;
+	simNextSend = nullptr;
+	simInFlight = nullptr;
+}
+
+// May be called again to restart with a new config, the previous fleet is freed
+
+void simSetup(const simConfig& cfg, std::function<bool(const char*, size_t)> send, unsigned long nowMs)
+{
+	simFree();
+	simCfg = cfg;
+	simSend = send;
+	simStats = simStatsT();
+	simRng.seed(cfg.seed);
+
+	int n = simNumTanks();
+	simTanks = new tank[n];
+	simFilling = new bool[n];
+	simAlarmSince = new unsigned long[n];
+	simLevelFlags = new std::uint8_t[n];
+	simMgrFlags = new std::uint8_t[n];
+	simNextSend = new unsigned long[cfg.numNodes];
+	simInFlight = new std::deque<uint64_t>[n];
+
+	for (int t = 0; t < n; t++)
+	{
+		tank& tk = simTanks[t];
+
+		tk.depth = cfg.depth;
+		tk.vCM = cfg.vCM;
+		tk.sonarOffset = cfg.sonarOffset;
+		tk.loAlarm = cfg.loAlarmFactor * cfg.depth;
+		tk.hiAlarm = cfg.hiAlarmFactor * cfg.depth;
+		tk.liquidDepth = simRandom(10, 100) * cfg.depth / 100.0F;   // spread starting levels
+		tk.syncFull = true;
+		simFilling[t] = false;
+		simAlarmSince[t] = 0;
+		simLevelFlags[t] = CLEARALARMS;
+		simMgrFlags[t] = CLEARALARMS;
+	}
+	for (int nd = 0; nd < cfg.numNodes; nd++) simNextSend[nd] = nowMs + simRandom(0, cfg.sendDelay);   // stagger nodes
+	simLastTick = nowMs;
+	simTokens = 0;
+}
+
+size_t simEncode(int nd, int t, char* payload, size_t len)
+{
+	static DynamicJsonDocument doc(SHARDDOCSIZE);
+	static DynamicJsonDocument scratch(SHARDDOCSIZE);
+	char node[SHARDNODELEN];
+
+	snprintf(node, sizeof(node), "SIM%03i", nd);
+	syncTankMsg(doc, node, simTanks[t], startingTankNum + t);
+	return(msgEncode(doc, simCfg.encoding, payload, len, scratch));
+}
+
+// Manager asked for a full message (shardPullHook)
+
+void simPull(int tankNum)
+{
+	int t = tankNum - startingTankNum;
+
+	if (t >= 0 && t < simNumTanks()) simTanks[t].syncFull = true;
+}
+
+// Advance the curves and send whatever is due
+
+void simTick(unsigned long nowMs)
+{
+	char payload[SIMPAYLOADSIZE];
+	float hours = (nowMs - simLastTick) / 3600000.0F;
+
+	simTokens += (nowMs - simLastTick) * simCfg.maxRate / 1000.0F;
+	if (simTokens > simCfg.maxRate) simTokens = simCfg.maxRate;   // at most one second of burst
+	simLastTick = nowMs;
+
+	for (int t = 0; t < simNumTanks(); t++)
+	{
+		tank& tk = simTanks[t];
+		std::uint8_t flags;
+
+		tk.liquidDepth += simFilling[t] ? simCfg.fillRate * hours : -simCfg.drainRate * hours;
+		if (tk.liquidDepth <= 0.05F * tk.depth) simFilling[t] = true;
+		if (tk.liquidDepth >= 0.95F * tk.depth) simFilling[t] = false;
+
+		// time a crossing from when the true level enters an alarm the manager has not already raised on noise
+		flags = alarmLevelFlags(tk, tk.liquidDepth);
+		if ((flags & ~simLevelFlags[t] & ~simMgrFlags[t]) && simAlarmSince[t] == 0) simAlarmSince[t] = nowMs;
+		if (flags == CLEARALARMS) simAlarmSince[t] = 0;
+		simLevelFlags[t] = flags;
+	}
+
+	for (int nd = 0; nd < simCfg.numNodes; nd++)
+	{
+		if ((long)(nowMs - simNextSend[nd]) < 0) continue;
+		simNextSend[nd] = nowMs + simCfg.sendDelay + simCfg.sleepDelay;
+
+		for (int t = nd * simCfg.tanksPerNode; t < (nd + 1) * simCfg.tanksPerNode; t++)
+		{
+			tank& tk = simTanks[t];
+			float level = tk.liquidDepth;
+			bool full = tk.syncFull;
+			size_t len;
+
+			if (simRandom(0, 100) < simCfg.dropoutPct || simTokens < 1.0F)
+			{
+				simStats.droppedBySim++;
+				continue;
+			}
+			simTokens -= 1.0F;
+
+			tk.liquidDepth = level + (simRandom(-100, 101) / 100.0F) * simCfg.noise;   // what the sonar reports
+			tk.liquidVolume = tk.liquidDepth * tk.vCM;
+			tk.alarmFlags = alarmLevelFlags(tk, tk.liquidDepth);
+			len = simEncode(nd, t, payload, sizeof(payload));
+			tk.liquidDepth = level;
+			if (len == 0) continue;
+
+			simStats.sent++;
+			if (simSend && simSend(payload, len)) simInFlight[t].push_back(simRealUs());
+			else
+			{
+				simStats.refused++;
+				tk.syncFull = full;   // the full message never arrived
+			}
+		}
+	}
+}
+
+// Manager side hooks: a reading for tank index t has been published, an alarm was raised or cleared for it
+
+void simOnIngest(int t)
+{
+	uint64_t latency;
+
+	if (t < 0 || t >= simNumTanks() || simInFlight[t].empty()) return;
+	latency = simRealUs() - simInFlight[t].front();
+	simInFlight[t].pop_front();
+	simStats.received++;
+	simStats.latencySum += latency;
+	if (latency > simStats.latencyMax) simStats.latencyMax = latency;
+}
+
+void simOnAlarm(int t, std::uint8_t alarmType, bool raised, unsigned long nowMs)
+{
+	uint64_t reaction;
+
+	if (t < 0 || t >= simNumTanks()) return;
+	if (raised) simMgrFlags[t] |= alarmType;
+	else simMgrFlags[t] &= ~alarmType;
+	if (!raised || simAlarmSince[t] == 0) return;
+	reaction = nowMs - simAlarmSince[t];
+	simStats.alarms++;
+	simStats.alarmReactionSum += reaction;
+	if (reaction > simStats.alarmReactionMax) simStats.alarmReactionMax = reaction;
+	simAlarmSince[t] = 0;   // count each crossing once
+}
+
+void simReport()
+{
+	unsigned long lost = simStats.sent - simStats.received;   // refused + rejected + never came out of the queues
+
+	printf("sim sent=%lu recv=%lu lost=%lu refused=%lu rejected=%lu simdrop=%lu\n", simStats.sent, simStats.received, lost, simStats.refused,
+		simStats.rejected, simStats.droppedBySim);
+	printf("latency avg=%lluus max=%lluus\n", (unsigned long long)(simStats.received ? simStats.latencySum / simStats.received : 0),
+		(unsigned long long)simStats.latencyMax);
+	printf("alarms=%lu reaction avg=%llums max=%llums\n", simStats.alarms, (unsigned long long)(simStats.alarms ? simStats.alarmReactionSum / simStats.alarms : 0),
+		(unsigned long long)simStats.alarmReactionMax);
+}
@@ -0,0 +1,108 @@
+//
+// test_agg.cpp
+//
+// Manager aggregates: site, per type and per pump buckets, the display unit queries and the summary message, including
+// more types and pumps than there are buckets.
+//
+
+#include "host.h"
+
+// Ten 200 cm x 10 L/cm tanks. Types W W P D S X W W W W, so X is a fifth type. Tanks 0-8 each have their own pump,
+// one more than MAXPUMPS; tank 9 has no pump and is ignored.
+
+std::string aggConfig()
+{
+	const char types[] = "WWPDSXWWWW";
+	std::string s = "{\"site\":{\"numtanks\":10,\"startingTankNum\":1,\"sitename\":\"host\",\"pssid\":\"ssid\","
+		"\"mqtt_topic_data\":\"tanksmon/data\"},\"tankdefs\":[";
+
+	for (int t = 0; t < 10; t++)
+	{
+		if (t) s += ",";
+		s += std::string("{\"tankType\":\"") + types[t] + "\",\"depth\":200,\"vCM\":10,\"pumpnode\":" + std::to_string(t < 9 ? t + 1 : 0) +
+			",\"pumpnumber\":1" + (t == 9 ? ",\"ignore\":true" : "") + "}";
+	}
+	return(s + "]}");
+}
+
+void setReading(int t, float volume, std::uint8_t flags)
+{
+	tanks[t].liquidVolume = volume;
+	tanks[t].alarmFlags = flags;
+	aggUpdate(t);
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(aggConfig()));
+	useAvg = false;
+	imperial = false;
+	aggInit();
+
+	// buckets and overflow
+	CHECK(aggSiteTotal.numTanks == 9);
+	CHECK(aggSiteTotal.capacity == 9 * 20000L);
+	CHECK(numAggTypes == MAXTANKTYPES && numAggPumps == MAXPUMPS);
+	CHECK(aggTypeOverflow == 1 && aggPumpOverflow == 1);
+	CHECK(aggFindType('X', false) == nullptr);
+	CHECK(aggFindPump(9, 1, false) == nullptr);
+	CHECK(aggFindPump(0, 0, false) == nullptr);
+
+	aggBucket* w = aggFindType('W', false);
+	aggBucket* p = aggFindType('P', false);
+	aggBucket* pump1 = aggFindPump(1, 1, false);
+	CHECK(w != nullptr && p != nullptr && pump1 != nullptr);
+	CHECK(w->numTanks == 5);   // tank 9 is ignored
+	CHECK(pump1->numTanks == 1);
+
+	// volumes and percent full
+	setReading(0, 1000, HIALARM);
+	setReading(1, 500, LOALARM);
+	setReading(2, 250, LOALARM | MAXDEPTH);
+	setReading(5, 100, 0);      // type X, site total only
+	setReading(9, 1000, 0);     // ignored
+	CHECKNEAR(aggVolume(&aggSiteTotal), 1850, 1e-3);
+	CHECKNEAR(aggVolume(w), 1500, 1e-3);
+	CHECKNEAR(aggVolume(p), 250, 1e-3);
+	CHECKNEAR(aggVolume(pump1), 1000, 1e-3);
+	CHECKNEAR(aggPercentFull(w), 1500 * 100.0 / (5 * 2000), 1e-3);
+	CHECKNEAR(aggPercentFull(pump1), 50, 1e-3);
+	CHECKNEAR(aggPercentFull(&aggSiteTotal), 1850 * 100.0 / (9 * 2000), 1e-3);
+	CHECK(aggVolume(nullptr) == 0 && aggPercentFull(nullptr) == 0);
+
+	imperial = true;
+	CHECKNEAR(aggVolume(&aggSiteTotal), 1850 * CVTFACTORGALLONS, 1e-3);
+	CHECKNEAR(aggVolume(w), 1500 * CVTFACTORGALLONS, 1e-3);
+	CHECKNEAR(aggPercentFull(w), 1500 * 100.0 / (5 * 2000), 1e-3);   // unit free
+	imperial = false;
+
+	// alarm counts follow raise and clear
+	CHECK(aggAlarmCount(&aggSiteTotal, HIALARM) == 1);
+	CHECK(aggAlarmCount(&aggSiteTotal, LOALARM) == 2);
+	CHECK(aggAlarmCount(&aggSiteTotal, MAXDEPTH) == 1);
+	CHECK(aggAlarmCount(w, HIALARM) == 1 && aggAlarmCount(w, LOALARM) == 1 && aggAlarmCount(w, MAXDEPTH) == 0);
+	CHECK(aggAlarmCount(p, LOALARM) == 1 && aggAlarmCount(p, MAXDEPTH) == 1);
+	CHECK(aggAlarmCount(w, 0) == 0 && aggAlarmCount(nullptr, HIALARM) == 0);
+	setReading(0, 900, 0);
+	setReading(2, 250, LOALARM);
+	CHECK(aggAlarmCount(&aggSiteTotal, HIALARM) == 0 && aggAlarmCount(w, HIALARM) == 0);
+	CHECK(aggAlarmCount(&aggSiteTotal, MAXDEPTH) == 0 && aggAlarmCount(p, LOALARM) == 1);
+	CHECKNEAR(aggVolume(pump1), 900, 1e-3);
+
+	// summary message reports the overflow
+	DynamicJsonDocument doc(4096);
+	aggSummaryMsg(doc);
+	CHECK(doc["nT"].as<int>() == 9);
+	CHECK(doc["ty"].size() == MAXTANKTYPES && doc["pu"].size() == MAXPUMPS);
+	CHECK(doc["ov"][0].as<int>() == 1 && doc["ov"][1].as<int>() == 1);
+	CHECK(doc["ty"][0]["aC"][1].as<int>() == 1);   // W, one LO
+
+	// no overflow, no "ov"
+	CHECK(hostLoadConfig(hostConfig(2)));
+	aggInit();
+	CHECK(aggTypeOverflow == 0 && aggPumpOverflow == 0);
+	aggSummaryMsg(doc);
+	CHECK(doc["ov"].isNull());
+
+	return(hostReport("test_agg"));
+}
@@ -0,0 +1,186 @@
+//
+// test_alarm.cpp
+//
+// Alarm notification dispatcher: per sink rate limit, coalescing of repeats, priority and posting order, the bounded
+// queue, acknowledgements and a raise/clear/raise flap, which must reach the sink as three events.
+//
+
+#include "host.h"
+
+std::vector<alarmEvent> got;
+bool accept = true;
+
+bool collect(const alarmEvent& ev)
+{
+	if (!accept) return(false);
+	got.push_back(ev);
+	return(true);
+}
+
+// One sink, nothing queued, nothing remembered
+
+int reset(unsigned long minInterval, unsigned long coalesceWindow)
+{
+	numAlarmSinks = 0;
+	got.clear();
+	accept = true;
+	for (int t = 0; t < numtanks; t++) tanks[t].alarmAck = 0;
+	return(alarmSubscribe(collect, minInterval, coalesceWindow));
+}
+
+bool isEvent(size_t i, int t, std::uint8_t alarmType, bool raised)
+{
+	return(i < got.size() && got[i].t == t && got[i].alarmType == alarmType && got[i].raised == raised);
+}
+
+void testRateLimit()
+{
+	int s = reset(1000, 0);
+
+	alarmPost(0, HIALARM, true, 10000);
+	alarmPost(1, HIALARM, true, 10000);
+	alarmPost(2, HIALARM, true, 10000);
+	CHECK(alarmDispatch(10000) == 1);
+	CHECK(alarmDispatch(10500) == 0);
+	CHECK(alarmDispatch(10999) == 0);
+	CHECK(alarmDispatch(11000) == 1);
+	CHECK(alarmDispatch(12000) == 1);
+	CHECK(alarmDispatch(13000) == 0 && alarmSinks[s].queued == 0);
+	CHECK(isEvent(0, 0, HIALARM, true) && isEvent(1, 1, HIALARM, true) && isEvent(2, 2, HIALARM, true));
+
+	// a sink that refuses keeps the event and is retried
+	alarmPost(3, LOALARM, true, 14000);
+	accept = false;
+	CHECK(alarmDispatch(14000) == 0 && alarmSinks[s].queued == 1);
+	accept = true;
+	CHECK(alarmDispatch(14001) == 1 && isEvent(3, 3, LOALARM, true));
+}
+
+void testPriority()
+{
+	reset(0, 0);
+
+	tanks[3].pumpNode = 0;
+	alarmPost(3, LOALARM, true, 1000);     // 1, not linked to a pump
+	alarmPost(0, HIALARM, true, 1001);     // 2
+	alarmPost(3, MAXDEPTH, true, 1002);    // 3
+	alarmPost(1, HIALARM, true, 1003);     // 2, after tank 0
+	alarmPost(2, PUMPFAULT, true, 1004);   // 3, after the MAXDEPTH
+	while (alarmDispatch(2000) > 0);
+	CHECK(got.size() == 5);
+	CHECK(isEvent(0, 3, MAXDEPTH, true) && isEvent(1, 2, PUMPFAULT, true));
+	CHECK(isEvent(2, 0, HIALARM, true) && isEvent(3, 1, HIALARM, true));
+	CHECK(isEvent(4, 3, LOALARM, true));
+	tanks[3].pumpNode = 2;
+}
+
+void testCoalesce()
+{
+	int s = reset(0, 5000);
+
+	// a repeat of a queued state is merged
+	alarmPost(0, HIALARM, true, 10000);
+	alarmPost(0, HIALARM, true, 10100);
+	CHECK(alarmSinks[s].queued == 1 && alarmSinks[s].coalesced == 1);
+	CHECK(alarmDispatch(10200) == 1 && got[0].count == 2 && got[0].ms == 10100);
+
+	// a repeat of the delivered state inside the window is dropped, outside it is delivered
+	alarmPost(0, HIALARM, true, 11000);
+	CHECK(alarmSinks[s].queued == 0 && alarmSinks[s].coalesced == 2);
+	alarmPost(0, HIALARM, true, 15300);
+	CHECK(alarmSinks[s].queued == 1);
+	CHECK(alarmDispatch(15300) == 1 && got.size() == 2);
+
+	// other tanks and alarms are not affected
+	alarmPost(0, LOALARM, true, 15400);
+	alarmPost(1, HIALARM, true, 15400);
+	CHECK(alarmSinks[s].queued == 2 && alarmSinks[s].coalesced == 2);
+}
+
+void testFlap()
+{
+	int s = reset(0, 60000);
+
+	// delivered raise, then clear and raise inside the window
+	alarmPost(0, HIALARM, true, 1000);
+	CHECK(alarmDispatch(1000) == 1);
+	alarmPost(0, HIALARM, false, 2000);
+	alarmPost(0, HIALARM, true, 3000);
+	CHECK(alarmSinks[s].queued == 2);
+	while (alarmDispatch(4000) > 0);
+	CHECK(got.size() == 3);
+	CHECK(isEvent(0, 0, HIALARM, true) && isEvent(1, 0, HIALARM, false) && isEvent(2, 0, HIALARM, true));
+
+	// the whole flap before anything is delivered: nothing merged, order kept
+	got.clear();
+	alarmPost(1, LOALARM, true, 5000);
+	alarmPost(1, LOALARM, false, 5100);
+	alarmPost(1, LOALARM, true, 5200);
+	CHECK(alarmSinks[s].queued == 3 && alarmSinks[s].coalesced == 0);
+	while (alarmDispatch(6000) > 0);
+	CHECK(got.size() == 3);
+	CHECK(isEvent(0, 1, LOALARM, true) && isEvent(1, 1, LOALARM, false) && isEvent(2, 1, LOALARM, true));
+
+	// raise then clear undelivered: the raise is not lost to the clear
+	got.clear();
+	alarmPost(2, HIALARM, true, 7000);
+	alarmPost(2, HIALARM, false, 7100);
+	while (alarmDispatch(8000) > 0);
+	CHECK(got.size() == 2 && isEvent(0, 2, HIALARM, true) && isEvent(1, 2, HIALARM, false));
+}
+
+void testBounded()
+{
+	int s = reset(0, 0);
+
+	for (int t = 0; t < numtanks; t++) tanks[t].pumpNode = 0;   // HI/LO all priority 1
+	for (int t = 0; t < 4; t++)
+	{
+		alarmPost(t, HIALARM, true, 1000 + t);
+		alarmPost(t, LOALARM, true, 1000 + t);
+	}
+	CHECK(alarmSinks[s].queued == ALARMQUEUESIZE && alarmSinks[s].dropped == 0);
+
+	// full: an event of the same priority is dropped, a higher one replaces the oldest lowest
+	alarmPost(0, HIALARM, false, 2000);
+	CHECK(alarmSinks[s].queued == ALARMQUEUESIZE && alarmSinks[s].dropped == 1);
+	alarmPost(1, MAXDEPTH, true, 2001);
+	CHECK(alarmSinks[s].queued == ALARMQUEUESIZE && alarmSinks[s].dropped == 2);
+
+	while (alarmDispatch(3000) > 0);
+	CHECK(got.size() == ALARMQUEUESIZE);
+	CHECK(isEvent(0, 1, MAXDEPTH, true));
+	CHECK(isEvent(1, 0, LOALARM, true));   // tank 0 HI raise was the oldest lowest
+	CHECK(isEvent(ALARMQUEUESIZE - 1, 3, LOALARM, true));
+	for (int t = 0; t < numtanks; t++) tanks[t].pumpNode = t / 2 + 1;
+}
+
+void testAck()
+{
+	int s = reset(0, 0);
+
+	alarmPost(0, HIALARM, true, 1000);
+	alarmPost(1, HIALARM, true, 1000);
+	tanks[0].alarmAck = HIALARM;
+	while (alarmDispatch(2000) > 0);
+	CHECK(alarmSinks[s].queued == 0);
+	CHECK(got.size() == 1 && isEvent(0, 1, HIALARM, true));
+
+	// clears are delivered whatever the ack
+	alarmPost(0, HIALARM, false, 3000);
+	CHECK(alarmDispatch(3000) == 1 && isEvent(1, 0, HIALARM, false));
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(4)));
+
+	testRateLimit();
+	testPriority();
+	testCoalesce();
+	testFlap();
+	testBounded();
+	testAck();
+	numAlarmSinks = 0;
+	return(hostReport("test_alarm"));
+}
@@ -0,0 +1,161 @@
+//
+// test_bank.cpp
+//
+// Dual bank storage and the config load order, with power loss injected after every flash operation (hostFsOpsLeft):
+// whatever was on flash before a save must still load afterwards, a torn bank is never taken and is the one replaced
+// next, and the config file only reaches a bank once it has loaded.
+//
+
+#include "host.h"
+
+#define BASE "/bank"
+
+std::string load(char skip = 0)
+{
+	byte buff[256];
+	size_t len = bankLoad(BASE, buff, sizeof(buff), skip);
+	return(std::string((const char*)buff, len));
+}
+
+bool save(const std::string& s)
+{
+	return(bankSave(BASE, (const byte*)s.data(), s.size()));
+}
+
+uint32_t generationOf(char bank)
+{
+	bankHeader hdr;
+	return(bankReadHeader(bank == 'A' ? BASE ".a" : BASE ".b", hdr, 0xFFFFFFFFUL) ? hdr.generation : 0);
+}
+
+void testCrc()
+{
+	const char* check = "123456789";
+
+	CHECK(crc32((const byte*)check, 9) == 0xCBF43926UL);
+	CHECK(crc32((const byte*)check + 4, 5, crc32((const byte*)check, 4)) == 0xCBF43926UL);
+	CHECK(crc32(nullptr, 0) == 0);
+}
+
+void testBasics()
+{
+	hostFsReset();
+	CHECK(load() == "");
+	CHECK(save("one") && load() == "one" && bankReport.bank == 'A' && bankReport.generation == 1);
+	CHECK(save("two") && load() == "two" && bankReport.bank == 'B' && bankReport.generation == 2);
+	CHECK(save("three") && load() == "three" && bankReport.bank == 'A' && bankReport.generation == 3);
+	CHECK(load('A') == "two" && bankReport.fellBack);
+
+	// corrupt the newest: the older one is loaded, and the next save replaces the corrupt one, not the good one
+	hostFiles[BASE ".a"].back() ^= 0xFF;
+	CHECK(load() == "two" && bankReport.fellBack);
+	CHECK(save("four") && load() == "four" && bankReport.bank == 'A' && generationOf('A') == 4);
+	CHECK(load('A') == "two");
+
+	// newest truncated (header says longer than the file)
+	hostFiles[BASE ".a"].resize(hostFiles[BASE ".a"].size() - 1);
+	CHECK(load() == "two");
+	CHECK(save("five") && load() == "five" && load('A') == "two");
+}
+
+// Power loss after k flash operations, for every k a save can take. Afterwards the newest good data is either the old
+// or the new body, and a save after the reboot succeeds without losing it.
+
+void powerLossSweep(const std::function<void()>& setup, const std::string& before)
+{
+	for (long k = 0; k < 12; k++)
+	{
+		hostFsReset();
+		setup();
+		hostFsOpsLeft = k;
+		bool saved = save("new body");
+		hostFsOpsLeft = -1;
+
+		std::string got = load();
+		CHECK(got == before || got == "new body");
+		if (saved) CHECK(got == "new body");
+		std::string lastGood = got;
+		CHECK(save("after reboot") && load() == "after reboot");
+		CHECK(load(bankReport.bank) == lastGood);
+	}
+}
+
+void testPowerLoss()
+{
+	powerLossSweep([]() { save("old"); }, "old");
+	powerLossSweep([]() { save("older"); save("old"); }, "old");
+	powerLossSweep([]() { save("old"); save("torn"); hostFiles[BASE ".b"].resize(sizeof(bankHeader) + 2); }, "old");
+	powerLossSweep([]() { save("old"); save("bad crc"); hostFiles[BASE ".b"].back() ^= 1; }, "old");
+}
+
+// Config: file vs banks
+
+std::string cfg(int n) { return(hostConfig(n)); }
+
+void testConfig()
+{
+	// first boot seeds a bank from the file
+	CHECK(hostLoadConfig(cfg(2)));
+	CHECK(numtanks == 2 && bankMaxLen(TANKSMONCFGBANK) == cfg(2).size());
+
+	// unchanged file: bank used, nothing written
+	CHECK(loadConfig() && bankReport.generation == 1);
+	uint32_t gen = bankReport.generation;
+	CHECK(loadConfig() && bankReport.generation == gen);
+
+	// changed file that loads: applied and committed
+	hostFsPut(TANKSMONCFGFILE, cfg(3));
+	CHECK(loadConfig() && numtanks == 3);
+	CHECK(loadConfig() && bankReport.generation == gen + 1 && numtanks == 3);
+
+	// changed file that does not parse, or does not validate: last bank used, nothing committed
+	hostFsPut(TANKSMONCFGFILE, "{\"site\":");
+	CHECK(loadConfig() && numtanks == 3 && bankReport.generation == gen + 1);
+	hostFsPut(TANKSMONCFGFILE, "{\"site\":{\"numtanks\":1},\"tankdefs\":[{\"depth\":9999}]}");
+	CHECK(loadConfig() && numtanks == 3 && bankReport.generation == gen + 1);
+	CHECK(loadConfig() && numtanks == 3);
+
+	// no file at all: banks
+	hostFiles.erase(TANKSMONCFGFILE);
+	CHECK(loadConfig() && numtanks == 3);
+
+	// newest bank has a good CRC but no longer loads (e.g. a schema change made it invalid): the other bank is used
+	std::string bad = "{\"site\":{\"numtanks\":2},\"tankdefs\":[{}]}";
+	CHECK(bankSave(TANKSMONCFGBANK, (const byte*)bad.data(), bad.size()));
+	CHECK(loadConfig() && numtanks == 3 && bankReport.fellBack);
+
+	// nothing usable anywhere
+	hostFsReset();
+	CHECK(!loadConfig());
+	hostFsMountFails = true;
+	CHECK(!loadConfig());
+	hostFsMountFails = false;
+}
+
+// Power loss while committing a new config file: the reboot still comes up, on either config
+
+void testConfigPowerLoss()
+{
+	for (long k = 0; k < 12; k++)
+	{
+		CHECK(hostLoadConfig(cfg(2)));
+		hostFsPut(TANKSMONCFGFILE, cfg(4));
+		hostFsOpsLeft = k;
+		loadConfig();
+		hostFsOpsLeft = -1;
+		CHECK(loadConfig() && numtanks == 4);
+		CHECK(bankMaxLen(TANKSMONCFGBANK) == cfg(4).size());
+		hostFiles.erase(TANKSMONCFGFILE);
+		CHECK(loadConfig() && numtanks == 4);
+	}
+}
+
+int main()
+{
+	testCrc();
+	testBasics();
+	testPowerLoss();
+	testConfig();
+	testConfigPowerLoss();
+	return(hostReport("test_bank"));
+}
@@ -0,0 +1,81 @@
+//
+// test_batch.cpp
+//
+// Batch kernels against the per tank path: alarm flags from alarmLevelFlags() with levels set by the sensor rather
+// than the factors, percent full, display units, and the slots the kernels must leave at 0, an ignored tank and a
+// gateway slot nobody has reported to yet.
+//
+
+#include "host.h"
+
+#define SLOTS 12
+
+float level[SLOTS], volume[SLOTS], depth[SLOTS], lo[SLOTS], hi[SLOTS], pct[SLOTS], disp[SLOTS];
+std::uint8_t mask[SLOTS];
+
+void gather()
+{
+	for (int t = 0; t < numtanks; t++)
+	{
+		level[t] = tanks[t].liquidDepth;
+		volume[t] = tanks[t].liquidVolume;
+		depth[t] = tanks[t].ignore ? 0 : tanks[t].depth;
+		lo[t] = tanks[t].loAlarm;
+		hi[t] = tanks[t].hiAlarm;
+	}
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(8)));
+	CHECK(shardInit(SLOTS));
+	CHECK(numtanks == SLOTS && tanks[8].depth == 0 && tanks[8].ignore);
+
+	// 200 cm tanks, alarm levels 60/180 from the sensor, not the config factors
+	const float levels[8] = { 0, 59, 60, 61, 179, 180, 200, 250 };
+	for (int t = 0; t < 8; t++)
+	{
+		tanks[t].loAlarm = 60;
+		tanks[t].hiAlarm = 180;
+		tanks[t].liquidDepth = levels[t];
+		tanks[t].liquidVolume = levels[t] * tanks[t].vCM;
+	}
+	tanks[3].ignore = true;
+	tanks[9].liquidDepth = 50;        // gateway slots, depth 0
+	tanks[10].ignore = false;         // reported once but no depth yet
+	tanks[10].liquidDepth = 50;
+	tanks[11].depth = 0.5F;           // fractional depth is still a depth
+	tanks[11].ignore = false;
+	tanks[11].loAlarm = 0.1F;
+	tanks[11].hiAlarm = 0.4F;
+	tanks[11].liquidDepth = 0.45F;
+
+	gather();
+	batchPercentFull(level, depth, pct, SLOTS);
+	batchAlarmMask(level, lo, hi, depth, mask, SLOTS);
+
+	for (int t = 0; t < SLOTS; t++)
+	{
+		CHECK(!std::isnan(pct[t]));
+		if (depth[t] == 0)
+		{
+			CHECK(pct[t] == 0 && mask[t] == 0);
+			continue;
+		}
+		CHECK(mask[t] == alarmLevelFlags(tanks[t], level[t]));
+		CHECKNEAR(pct[t], level[t] * 100.0F / tanks[t].depth, 1e-4);
+	}
+	CHECK(mask[1] == LOALARM && mask[2] == LOALARM && mask[4] == 0);
+	CHECK(mask[5] == HIALARM && mask[7] == (HIALARM | MAXDEPTH) && mask[11] == HIALARM);
+	CHECK(depth[3] == 0 && mask[3] == 0);
+
+	// the kernels leave the tanks alone
+	CHECK(tanks[0].loAlarm == 60 && tanks[0].hiAlarm == 180);
+
+	batchScale(volume, disp, SLOTS, CVTFACTORGALLONS);
+	for (int t = 0; t < SLOTS; t++) CHECKNEAR(disp[t], volume[t] * CVTFACTORGALLONS, 1e-4);
+	batchScale(level, disp, SLOTS, CVTFACTORINCHES);
+	CHECKNEAR(disp[6], 200 * CVTFACTORINCHES, 1e-4);
+
+	return(hostReport("test_batch"));
+}
@@ -0,0 +1,80 @@
+//
+// test_boot.cpp
+//
+// Boot profiler against the stub FS with the host heap model: loadConfig() marks its phases in order on a first boot
+// (config file) and a reboot (bank), the report adds up, the heap low water mark follows the tank table allocation,
+// and a MAXTANKS boot stays inside BOOTBUDGETMS of real time. A heap too small for the plan fails the boot.
+//
+
+#define TANKSMON_HOSTHEAP hostFreeHeap
+#include "host.h"
+
+#define BOOTBUDGETMS 250   // host time for a MAXTANKS config, sanitizers on, generous on purpose
+#define HOSTHEAP     250000   // the stub FS and std containers allocate through new as well
+
+DynamicJsonDocument doc(2048);
+
+// What the sketch does at reset: nothing marked yet, the first phase runs from now
+
+void bootReset()
+{
+	numBootPhases = 0;
+	bootLastMark = micros();
+	bootMinHeap = 0xFFFFFFFFUL;
+}
+
+bool boot()
+{
+	bootReset();
+	if (!loadConfig()) return(false);
+	bootMark(PSTR("sonar"));   // a sketch phase after loadConfig()
+	bootReportMsg(doc, "node1");
+	return(true);
+}
+
+void checkReport(const char* what, bool fresh)
+{
+	const char* const expected[] = { "mount", "cfgread", "cfgparse", "cfgdump", "tanks", "sonar" };
+	JsonArray b = doc["b"];
+	float total = 0;
+	uint32_t minHeap = 0xFFFFFFFFUL;
+
+	CHECK(b.size() == 6);
+	for (int i = 0; i < 6 && i < (int)b.size(); i++)
+	{
+		if (strcmp(b[i][0] | "", expected[i]) != 0) printf("%s: phase %i is %s\n", what, i, b[i][0] | "?");
+		CHECK(strcmp(b[i][0] | "", expected[i]) == 0);
+		CHECK(b[i][1].as<float>() >= 0);
+		total += b[i][1].as<float>();
+		minHeap = std::min(minHeap, b[i][2].as<uint32_t>());
+	}
+	CHECKNEAR(doc["tot"].as<float>(), total, 0.01);
+	CHECK(doc["minH"].as<uint32_t>() == minHeap && minHeap > 0);
+	if (fresh) CHECK(b[4][2].as<uint32_t>() < b[0][2].as<uint32_t>());   // the tank table is allocated by the "tanks" phase
+	CHECK(doc["tot"].as<float>() < BOOTBUDGETMS);
+	printf("%s: %.2f ms, min heap %u\n", what, doc["tot"].as<float>(), doc["minH"].as<unsigned>());
+}
+
+int main()
+{
+	hostRealClock = true;
+	hostFsReset();
+	hostFsPut(TANKSMONCFGFILE, hostConfig(MAXTANKS));
+
+	hostHeapSize = HOSTHEAP;
+	CHECK(boot());
+	checkReport("first boot", true);
+	CHECK(memPlan.freeHeap > 0 && memPlan.headroom > 0);
+
+	CHECK(boot());
+	checkReport("reboot", false);   // same process, the previous tank table is freed on the way
+	CHECK(bankReport.bank != 0 && !bankReport.fellBack);
+
+	// the planned buffers do not fit: boot fails instead of running out of heap later
+	hostHeapSize = hostHeapUsed;
+	CHECK(!boot());
+	hostHeapSize = HOSTHEAP;
+
+	hostRealClock = false;
+	return(hostReport("test_boot"));
+}
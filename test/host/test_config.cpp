@@ -0,0 +1,163 @@
+//
+// test_config.cpp
+//
+// Config loader: known good/bad files, then a mutation fuzz. Every mutated file must either load with all invariants
+// holding or be rejected; run under ASan/UBSan (make test) so out of bounds and dangling string pointers show up.
+//
+
+#include "host.h"
+
+// Everything downstream relies on these after a successful load
+
+void checkInvariants()
+{
+	CHECK(numtanks >= 1 && numtanks <= MAXTANKS);
+	CHECK(startingTankNum >= 0 && startingTankNum <= 1000);
+	CHECK(msgEncData >= ENC_JSON && msgEncData <= ENC_MSGPACK);
+	CHECK(tankpingdelay >= 100);
+	CHECK(sitename != nullptr && strlen(sitename) < 1024);
+	CHECK(pssid != nullptr && ppwd != nullptr && assid != nullptr && apwd != nullptr && strlen(pssid) + strlen(ppwd) + strlen(assid) + strlen(apwd) < 4096);
+	for (int t = 0; t < numtanks; t++)
+	{
+		CHECK(tanks[t].timeOut > 0);
+		CHECK(tanks[t].depth >= 1 && tanks[t].depth <= MAXPINGDISTANCE);
+		CHECK(tanks[t].vCM > 0);
+		CHECK(tanks[t].loAlarm < tanks[t].hiAlarm);
+		CHECK(tanks[t].minPingDelay <= tanks[t].maxPingDelay);
+		CHECK(tanks[t].pingDelay > 0);
+		CHECK(tanks[t].tankType != nullptr);
+	}
+	CHECK(payloadBuff != nullptr && presistBuff != nullptr);
+}
+
+// One tank config with a single field of the standard tank entry replaced
+
+std::string tankField(const std::string& from, const std::string& to)
+{
+	std::string s = hostConfig(1);
+	size_t pos = s.find(from);
+
+	if (pos != std::string::npos) s.replace(pos, from.size(), to);
+	return(s);
+}
+
+void testKnown()
+{
+	CHECK(hostLoadConfig(hostConfig(4)));
+	checkInvariants();
+	CHECK(numtanks == 4);
+	CHECK(strcmp(sitename, "host") == 0);
+	CHECKNEAR(tanks[0].loAlarm, 20, 1e-3);   // default factors 0.10/1.10 of 200 cm
+	CHECKNEAR(tanks[0].hiAlarm, 220, 1e-3);
+	CHECK(tanks[0].timeOut == 60000UL);
+
+	// booleans as true/false or 0/1
+	CHECK(hostLoadConfig(hostConfig(1, "\"imperial\":1,\"dst\":0,\"debug\":0,\"useavg\":true,")));
+	CHECK(imperial && !dst && useAvg);
+	CHECK(hostLoadConfig(hostConfig(1, "\"imperial\":false,\"dst\":true,")));
+	CHECK(!imperial && dst);
+	CHECK(!hostLoadConfig(hostConfig(1, "\"dst\":2,")));
+	CHECK(numCfgErrors == 1 && cfgErrors[0].code == CFGERR_RANGE && !dst);
+	CHECK(!hostLoadConfig(hostConfig(1, "\"imperial\":\"yes\",")));
+	CHECK(numCfgErrors == 1 && cfgErrors[0].code == CFGERR_TYPE);
+
+	// integer fields are read as integers, the full long range is exact
+	CHECK(hostLoadConfig(tankField("\"pumpnode\":1", "\"pumpnode\":2147483647")));
+	CHECK(tanks[0].pumpNode == 2147483647L);
+	CHECK(hostLoadConfig(tankField("\"pumpnode\":1", "\"pumpnode\":16777217")));
+	CHECK(tanks[0].pumpNode == 16777217L);
+	CHECK(!hostLoadConfig(tankField("\"pumpnode\":1", "\"pumpnode\":2147483648")));
+	CHECK(numCfgErrors == 1 && cfgErrors[0].code == CFGERR_RANGE && tanks[0].pumpNode == 0);
+	CHECK(!hostLoadConfig(tankField("\"pumpnumber\":1", "\"pumpnumber\":1.5")));
+	CHECK(numCfgErrors == 1 && cfgErrors[0].code == CFGERR_TYPE);
+	CHECK(!hostLoadConfig(tankField("\"timeout\":60", "\"timeout\":1e12")));
+	CHECK(numCfgErrors == 1 && cfgErrors[0].code == CFGERR_RANGE);
+
+	// every error reported in one pass
+	CHECK(!hostLoadConfig("{\"site\":{\"numtanks\":2,\"startingTankNum\":-1,\"timezone\":\"x\"},\"tankdefs\":[{\"depth\":9999},{}]}"));
+	CHECK(numCfgErrors >= 8);
+
+	// a string left out of the new file falls back to the compiled in default, not the previous buffer
+	CHECK(hostLoadConfig(hostConfig(1, "\"altssid\":\"alt\",")));
+	CHECK(strcmp(assid, "alt") == 0);
+	CHECK(hostLoadConfig(hostConfig(1)));
+	CHECK(strcmp(assid, "") == 0);
+
+	CHECK(!hostLoadConfig("{\"site\":"));
+	CHECK(!hostLoadConfig(""));
+}
+
+// Mutations
+
+const char* const values[] = { "0", "1", "-1", "2", "true", "false", "null", "\"\"", "\"x\"", "[]", "{}", "1e39", "-1e39", "0.5",
+	"2147483648", "-2147483649", "99999999999", "[1,2,3]", "{\"a\":1}", "\"W\"", "33", "400", "401" };
+
+std::string mutate(const std::string& in)
+{
+	std::string s = in;
+	int n = 1 + random(4);
+
+	while (n--)
+	{
+		size_t pos = random(s.size());
+		switch (random(6)) {
+		case 0:   // replace the value after a random key
+		{
+			size_t colon = s.find(':', pos);
+			if (colon == std::string::npos) break;
+			size_t end = s.find_first_of(",}", colon + 1);
+			if (s[colon + 1] == '[' || s[colon + 1] == '{') break;
+			if (end == std::string::npos) break;
+			s.replace(colon + 1, end - colon - 1, values[random(sizeof(values) / sizeof(values[0]))]);
+			break;
+		}
+		case 1:   // drop a random "key":value
+		{
+			size_t q = s.find("\"", pos);
+			size_t end = (q == std::string::npos) ? q : s.find_first_of(",}", q);
+			if (end == std::string::npos || s[end] != ',') break;
+			s.erase(q, end - q + 1);
+			break;
+		}
+		case 2:
+			s.resize(pos);
+			break;
+		case 3:
+			s[pos] = (char)random(256);
+			break;
+		case 4:
+			s.insert(pos, 1, "{}[]\",:0-\\"[random(11)]);
+			break;
+		case 5:   // random number
+			s.replace(pos, 0, std::to_string(random(-100000, 100000)));
+			break;
+		}
+	}
+	return(s);
+}
+
+int main()
+{
+	int loaded = 0;
+	const int iterations = 3000;
+
+	testKnown();
+
+	randomSeed(26);
+	for (int i = 0; i < iterations; i++)
+	{
+		std::string base = hostConfig(1 + random(6), random(2) ? "\"imperial\":true,\"timezone\":-5," : "", random(2) ? "\"loAlarmFactor\":0.2,\"hiAlarmFactor\":0.9," : "");
+		int failsBefore = hostFails;
+
+		if (hostLoadConfig(mutate(base)))
+		{
+			loaded++;
+			checkInvariants();
+		}
+		if (hostFails != failsBefore) break;   // one broken input is enough to report
+	}
+	printf("config fuzz: %i of %i mutated files loaded\n", loaded, iterations);
+	CHECK(loaded > 0 && loaded < iterations);
+
+	return(hostReport("test_config"));
+}
@@ -0,0 +1,75 @@
+//
+// test_conn.cpp
+//
+// Connection manager: hooks missing, backoff and SSID failover, and a WiFi drop after MQTT failures starting over with
+// a fresh attempt count.
+//
+
+#include "host.h"
+
+bool wifi = false;
+bool mqtt = false;
+bool mqttOk = false;
+std::vector<std::string> begun;
+int onlineCalls = 0;
+
+void run(unsigned long ms)
+{
+	for (unsigned long end = millis() + ms; (long)(millis() - end) < 0; hostAdvance(10)) connTick(millis());
+}
+
+int main()
+{
+	pssid = "main";
+	assid = "alt";
+	wifiTryAlt = true;
+
+	// nothing set up yet: no call through an empty std::function
+	connTick(millis());
+	CHECK(connState == CONN_WIFI_START);
+
+	connOps.wifiBegin = [](const char* ssid, const char* pwd) { begun.push_back(ssid); };
+	connOps.wifiUp = []() { return(wifi); };
+	connOps.mqttConnect = []() { mqtt = mqttOk; return(mqtt); };
+	connOps.mqttUp = []() { return(mqtt); };
+	connOps.onOnline = []() { onlineCalls++; };
+
+	// no AP: CONNWIFIATTEMPTS on the main SSID, then the alternate
+	run(CONNWIFIATTEMPTS * (CONNWIFITIMEOUT + 2 * CONNBACKOFFMAX));
+	CHECK(begun.size() > CONNWIFIATTEMPTS);
+	CHECK(begun[0] == "main" && begun[CONNWIFIATTEMPTS - 1] == "main" && begun[CONNWIFIATTEMPTS] == "alt");
+
+	// AP comes back, broker refuses a few times
+	begun.clear();
+	wifi = true;
+	run(CONNWIFITIMEOUT + 2 * CONNBACKOFFMAX);
+	CHECK(connState == CONN_MQTT && connAttempts >= 2);
+
+	// WiFi drops while retrying MQTT: association starts over on the same SSID with a fresh count
+	wifi = false;
+	connNextTry = millis();
+	connTick(millis());
+	CHECK(connState == CONN_WIFI_START && connAttempts == 0);
+	connTick(millis());
+	CHECK(connState == CONN_WIFI_WAIT && begun.back() == (connUsingAlt ? "alt" : "main"));
+
+	// everything up
+	wifi = true;
+	mqttOk = true;
+	run(1000);
+	CHECK(connOnline() && onlineCalls == 1 && connAttempts == 0);
+
+	// broker drops, then WiFi drops while online
+	mqtt = false;
+	mqttOk = false;
+	run(3 * CONNBACKOFFMAX);
+	CHECK(connState == CONN_MQTT && connAttempts > 0);
+	mqttOk = true;
+	run(2 * CONNBACKOFFMAX);
+	CHECK(connOnline() && onlineCalls == 2);
+	wifi = false;
+	connTick(millis());
+	CHECK(connState == CONN_WIFI_START && connAttempts == 0);
+
+	return(hostReport("test_conn"));
+}
@@ -0,0 +1,207 @@
+//
+// test_fed.cpp
+//
+// Federation with several site managers and an aggregator in one process. Each site manager's state (tanks[], site
+// name, snapshot schedule) is swapped into the globals while it runs; messages go through a serialized in-memory broker
+// that can refuse publishes. Covers boot snapshots, deltas, a failed publish, an aggregator restart answered by a pull,
+// and the periodic snapshot keeping quiet sites from expiring.
+//
+
+#include "host.h"
+
+struct siteMgr {
+	std::string name;
+	int first;                   // startingTankNum
+	std::vector<tank> tk;
+	bool fullPending = true;
+	unsigned long lastFull = 0;
+};
+
+std::vector<siteMgr> sites;
+std::vector<std::string> upstream;   // site managers -> aggregator
+std::vector<std::string> ctrl;       // aggregator -> site managers
+bool brokerUp = true;
+int published = 0;
+
+DynamicJsonDocument doc(4096);
+
+void enter(siteMgr& sm)
+{
+	tanks = sm.tk.data();
+	numtanks = sm.tk.size();
+	sitename = sm.name.c_str();
+	startingTankNum = sm.first;
+	fedFullPending = sm.fullPending;
+	fedLastFull = sm.lastFull;
+}
+
+void leave(siteMgr& sm)
+{
+	sm.fullPending = fedFullPending;
+	sm.lastFull = fedLastFull;
+	tanks = nullptr;
+	numtanks = 0;
+}
+
+// What a site manager's loop() does: handle control messages, then publish a snapshot or delta
+
+void siteTick(siteMgr& sm)
+{
+	enter(sm);
+	for (auto& m : ctrl)
+	{
+		DynamicJsonDocument c(256);
+		deserializeJson(c, m);
+		fedOnPull(c);
+	}
+
+	bool full = fedFullDue(millis());
+	if (fedDeltaMsg(doc, numtanks, full) > 0 || full)
+	{
+		std::string out;
+		serializeJson(doc, out);
+		if (brokerUp)
+		{
+			upstream.push_back(out);
+			published++;
+			fedAck(doc, millis());
+		}
+	}
+	leave(sm);
+}
+
+void aggTick()
+{
+	DynamicJsonDocument in(4096);
+
+	ctrl.clear();
+	for (auto& m : upstream)
+	{
+		CHECK(!deserializeJson(in, m));
+		if (fedApply(in, millis()))
+		{
+			std::string out;
+			fedCtrlMsg(doc, in["s"], -1, FEDPULLCMD);
+			serializeJson(doc, out);
+			ctrl.push_back(out);
+		}
+	}
+	upstream.clear();
+}
+
+void step(unsigned long ms = 1000)
+{
+	hostAdvance(ms);
+	for (auto& sm : sites) siteTick(sm);
+	aggTick();
+}
+
+// volume in L as aggUpdate() would count it
+void setVolume(int s, int t, float litres, std::uint8_t flags = 0)
+{
+	sites[s].tk[t].aggVolume = (long)(litres * 10.0F);
+	sites[s].tk[t].aggFlags = flags;
+}
+
+long aggVolumeOf(int s, int tankNum)
+{
+	fedTank* ft = fedLookup(sites[s].name.c_str(), tankNum);
+	return(ft ? ft->volume : -1);
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(1)));
+	tank* own = tanks;
+
+	// a site manager never allocates the aggregator tables
+	CHECK(fedSites == nullptr && fedLookup("site0", 1) == nullptr);
+	fedExpire(0);
+	fedInit();
+	CHECK(fedSites != nullptr && numFedTanks == 0);
+	for (int s = 0; s < 3; s++)
+	{
+		siteMgr sm;
+		sm.name = "site" + std::to_string(s);
+		sm.first = 1;   // every site numbers from 1, the aggregator keeps them apart
+		sm.tk.resize(4 + s);
+		sites.push_back(sm);
+		for (int t = 0; t < 4 + s; t++) setVolume(s, t, 100 * (s + 1) + t);
+	}
+
+	// boot: every site sends a snapshot, including unchanged tanks
+	step();
+	CHECK(published == 3 && numFedTanks == 4 + 5 + 6);
+	CHECK(aggVolumeOf(2, 6) == 3050);
+	for (auto& sm : sites) CHECK(!sm.fullPending);
+
+	// nothing changed: nothing published
+	step();
+	CHECK(published == 3);
+
+	// one change, one delta
+	setVolume(1, 2, 42);
+	step();
+	CHECK(published == 4 && aggVolumeOf(1, 3) == 420);
+
+	// broker down: the change is not lost, it goes out with the next delta
+	setVolume(0, 0, 7, LOALARM);
+	brokerUp = false;
+	step();
+	CHECK(aggVolumeOf(0, 1) == 1000);
+	brokerUp = true;
+	step();
+	CHECK(aggVolumeOf(0, 1) == 70 && fedLookup("site0", 1)->alarmFlags == LOALARM);
+
+	// aggregator restarts: the next delta carries one tank and triggers a pull, the snapshot fills in the rest
+	fedInit();
+	setVolume(2, 0, 1);
+	step();
+	CHECK(numFedTanks == 1 && ctrl.size() == 1);
+	step();
+	CHECK(sites[2].lastFull == millis() && numFedTanks == 6);
+	CHECK(aggVolumeOf(2, 4) == 3030);
+	step();
+	CHECK(ctrl.empty());
+
+	// only one pull per FEDPULLRETRY for a site that keeps sending deltas without answering
+	fedInit();
+	setVolume(1, 0, 2);
+	step();
+	CHECK(ctrl.size() == 1);
+	sites[1].fullPending = false;
+	ctrl.clear();                  // pull lost
+	setVolume(1, 0, 3);
+	siteTick(sites[1]);
+	aggTick();
+	CHECK(ctrl.empty());
+	hostAdvance(FEDPULLRETRY);
+	setVolume(1, 0, 4);
+	siteTick(sites[1]);
+	aggTick();
+	CHECK(ctrl.size() == 1);
+	step();
+	CHECK(numFedTanks == 5);   // site0 and site2 had nothing to send, they come back with their periodic snapshot
+
+	// no changes for longer than FEDSITETIMEOUT: periodic snapshots keep every site alive
+	for (unsigned long ms = 0; ms < 2 * FEDSITETIMEOUT; ms += 60000)
+	{
+		step(60000);
+		fedExpire(millis());
+	}
+	CHECK(fedFindSite("site0", false) >= 0 && fedFindSite("site1", false) >= 0 && fedFindSite("site2", false) >= 0);
+	CHECK(numFedTanks == 4 + 5 + 6);
+
+	// a site that stops publishing does expire
+	sites.pop_back();
+	for (unsigned long ms = 0; ms <= FEDSITETIMEOUT; ms += 60000)
+	{
+		step(60000);
+		fedExpire(millis());
+	}
+	CHECK(fedFindSite("site2", false) < 0 && numFedTanks == 4 + 5);
+
+	tanks = own;
+	numtanks = 1;
+	return(hostReport("test_fed"));
+}
@@ -0,0 +1,77 @@
+//
+// test_forecast.cpp
+//
+// Consumption forecast: steady drain, refill, a one sample leak spike and a sustained rise in consumption.
+//
+
+#include "host.h"
+
+unsigned long ts = 1000000UL;
+float volume = 1500;
+
+void drain(float litres, int hours = 1)
+{
+	volume -= litres;
+	ts += 3600UL * hours;
+	tanks[0].liquidVolume = volume;
+	fcUpdate(0, ts);
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(1)));   // 200 cm x 10 L/cm
+
+	tanks[0].liquidVolume = volume;
+	fcUpdate(0, ts);
+	CHECK(tanks[0].fcTime == ts && tanks[0].fcRate == 0);
+
+	// steady 10 L/h converges
+	for (int i = 0; i < 30; i++) drain(10);
+	CHECKNEAR(tanks[0].fcRate, 10, 0.05);
+	CHECK(tanks[0].fcFlags == 0);
+	CHECKNEAR(fcTimeToEmpty(0), volume / tanks[0].fcRate, 0.01);
+	CHECKNEAR(fcTimeToLow(0), (volume - tanks[0].loAlarm * tanks[0].vCM) / tanks[0].fcRate, 0.01);
+
+	// too close to the last sample, skipped
+	ts += 10;
+	tanks[0].liquidVolume = volume - 5;
+	fcUpdate(0, ts);
+	CHECK(tanks[0].fcTime == ts - 10);
+	ts -= 10;
+
+	// refill is flagged and not folded in
+	float rate = tanks[0].fcRate;
+	drain(-500);
+	CHECK(tanks[0].fcFlags == FCREFILL);
+	CHECK(tanks[0].fcRate == rate);
+
+	// a single spike is flagged and not folded in
+	drain(100);
+	CHECK(tanks[0].fcFlags == FCLEAK);
+	CHECK(tanks[0].fcRate == rate);
+	drain(10);
+	CHECK(tanks[0].fcFlags == 0);
+	CHECK(tanks[0].fcFastCount == 0);
+
+	// consumption goes up to 100 L/h and stays there: held back for FCLEAKSAMPLES - 1 samples, then followed
+	rate = tanks[0].fcRate;
+	for (int i = 1; i < FCLEAKSAMPLES; i++)
+	{
+		drain(100);
+		CHECK(tanks[0].fcFlags == FCLEAK);
+		CHECK(tanks[0].fcRate == rate);
+	}
+	drain(100);
+	CHECK(tanks[0].fcFlags == FCLEAK);
+	CHECK(tanks[0].fcRate > rate);
+	for (int i = 0; i < 20; i++) drain(100);
+	CHECK(tanks[0].fcFlags == 0);   // caught up, no longer a leak
+	CHECKNEAR(tanks[0].fcRate, 100, 5);
+
+	// clock went backwards, restart
+	ts -= 7200;
+	drain(0, 0);
+	CHECK(tanks[0].fcTime == ts && tanks[0].fcFlags == 0);
+
+	return(hostReport("test_forecast"));
+}
@@ -0,0 +1,184 @@
+//
+// test_memplan.cpp
+//
+// Memory budget planner: the plan follows the config, the largest message of every kind fits the planned message doc
+// and payload buffer for a MAXTANKS site, the persist doc holds every key of every tank (PERSISTTANKKEYS) only because
+// loadPersist() parses in place, the positional data topic encodings fit their planned scratch doc, the flash table
+// report counts every table and string, and the deprecated fixed sizes are still defined for older sketches.
+//
+
+#include "host.h"
+
+static_assert(JSONCONFIGDOCSIZE == 4000 && JSONPERSISTDOCSIZE == 50, "deprecated config/persist sizes");
+static_assert(MAXPAYLOADSIZE == 4000 && MAXJSONSIZE == 4000 && MSGBUFFSIZE == 80, "deprecated message sizes");
+
+const char* const types[MAXTANKTYPES] = { "W", "P", "D", "S" };
+
+// Serialized into the planned payload buffer without overflowing either
+
+void checkFits(const char* what)
+{
+	size_t len = serializeJson(tankmsg, payloadBuff, memPlan.payload);
+
+	if (tankmsg.overflowed() || len == 0 || len >= memPlan.payload)
+		printf("%s: doc %u of %u, %u bytes of %u\n", what, (unsigned)tankmsg.memoryUsage(), (unsigned)memPlan.msgDoc, (unsigned)len,
+			(unsigned)memPlan.payload);
+	CHECK(!tankmsg.overflowed());
+	CHECK(len > 0 && len < memPlan.payload);
+}
+
+void testScaling()
+{
+	std::string small = hostConfig(1);
+	CHECK(hostLoadConfig(small));
+	memPlanT one = memPlan;
+	CHECK(one.configBuff == small.size() + 1);
+
+	CHECK(hostLoadConfig(hostConfig(MAXTANKS)));
+	CHECK(memPlan.tanks == MAXTANKS * one.tanks);
+	CHECK(memPlan.history == MAXTANKS * one.history);
+	CHECK(memPlan.persistDoc > one.persistDoc && memPlan.persistBuff > one.persistBuff);
+	CHECK(memPlan.configDoc > one.configDoc);
+	CHECK(memPlan.total == memPlan.configBuff + memPlan.configDoc + memPlan.tanks + memPlan.msgDoc + memPlan.msgScratch + memPlan.payload +
+		memPlan.persistDoc + memPlan.persistBuff + memPlan.history);
+}
+
+void testMessages()
+{
+	DynamicJsonDocument req(256);
+
+	CHECK(hostLoadConfig(hostConfig(MAXTANKS)));
+	sitename = "a-site-name-of-twenty-three";
+	for (int t = 0; t < numtanks; t++)
+	{
+		tanks[t].tankType = types[t % MAXTANKTYPES];
+		tanks[t].pumpNumber = t % MAXPUMPS + 1;
+		tanks[t].liquidDepth = -123.456789F;
+		tanks[t].liquidVolume = -12345.6789F;
+		tanks[t].alarmFlags = HIALARM | MAXDEPTH;
+		for (int i = 0; i < HISTDEPTH; i++) histAdd(t, 4000000000UL + i);
+	}
+	aggInit();
+
+	tanks[0].syncFull = true;
+	tanks[0].fcFlags = FCLEAK;
+	syncTankMsg(tankmsg, "tanksmon-node-name-of-23", 0, 1000000);
+	checkFits("tank");
+
+	aggSummaryMsg(tankmsg);
+	CHECK(numAggTypes == MAXTANKTYPES && numAggPumps == MAXPUMPS);
+	checkFits("summary");
+
+	fedDeltaMsg(tankmsg, numtanks, true);
+	checkFits("federation snapshot");
+
+	req["f"] = 0;
+	rpcHist(req, tankmsg, "tanksmon-node-name-of-23", 2147483647L, 0);
+	CHECK(tankmsg["h"].size() == RPCMAXHIST);
+	checkFits("history");
+
+	numBootPhases = 0;
+	for (int i = 0; i < BOOTMAXPHASES + 2; i++) bootMark(PSTR("phasename15char"));
+	bootMinHeap = 4000000000UL;
+	for (int i = 0; i < numBootPhases; i++) bootPhases[i].freeHeap = 4000000000UL;
+	bootReportMsg(tankmsg, "tanksmon-node-name-of-23");
+	checkFits("boot report");
+	sitename = "host";
+}
+
+// Every persist key of every tank at its longest. The keys would not fit the planned doc if they were copied.
+
+void testPersist()
+{
+	CHECK(hostLoadConfig(hostConfig(MAXTANKS)));
+	for (int t = 0; t < numtanks; t++)
+	{
+		tanks[t].liquidDepth = -123.456789F;
+		tanks[t].calA = -1.23456789F;
+		tanks[t].calB = -123.456789F;
+		tanks[t].plateauLevel = -123.456789F;
+		tanks[t].plateauSince = 4294967295UL;
+		tanks[t].loAlarmFactor = 0.123456789F;
+		tanks[t].hiAlarmFactor = 1.23456789F;
+		tanks[t].alarmSet = true;
+	}
+	CHECK(savePersist());
+	CHECK(!persistDoc.overflowed());
+	CHECK(persistDoc["tanklevels"][0].size() == PERSISTTANKKEYS);
+
+	std::string text;
+	serializeJson(persistDoc, text);
+	CHECK(text.size() < memPlan.persistBuff);
+
+	CHECK(loadConfig() && loadPersist());
+	CHECK(!persistDoc.overflowed() && persistDoc.memoryUsage() <= memPlan.persistDoc);
+	CHECK(tanks[MAXTANKS - 1].alarmSet && tanks[MAXTANKS - 1].plateauSince == 4294967295UL);
+
+	DynamicJsonDocument copied(memPlan.persistDoc);
+	CHECK(deserializeJson(copied, text.c_str()) == DeserializationError::NoMemory || copied.overflowed());
+}
+
+// The data topic encoding from the config: scratch planned only when needed, full and delta tank messages fit, and a
+// delta has no null padding
+
+void testEncodings()
+{
+	CHECK(hostLoadConfig(hostConfig(1)));
+	CHECK(memPlan.msgScratch == 0);
+
+	for (int enc = ENC_JSONPOS; enc <= ENC_MSGPACK; enc++)
+	{
+		DynamicJsonDocument decoded(memPlan.msgDoc);
+		DynamicJsonDocument scratch(memPlan.msgDoc);
+		std::string site = "\"mqtt_enc_data\":" + std::to_string(enc) + ",";
+
+		CHECK(hostLoadConfig(hostConfig(1, site)));
+		CHECK(msgEncData == enc && memPlan.msgScratch > 0 && msgScratch.capacity() > 0);
+		tanks[0].liquidDepth = -123.456789F;
+		tanks[0].syncFull = true;
+		tanks[0].tankType = "P";
+
+		size_t len = msgTankPayload("tanksmon-node-name-of-23", 0, 1000000);
+		CHECK(len > 0 && len < memPlan.payload && !msgScratch.overflowed());
+		CHECK(msgDecode(payloadBuff, len, decoded, scratch));
+		CHECK(decoded.size() == NUMMSGKEYS - 3);   // all but the manager's forecast
+		CHECK(decoded["t"].as<long>() == 1000000 && strcmp(decoded["tT"] | "", "P") == 0);
+
+		len = msgTankPayload("tanksmon-node-name-of-23", 0, 1000000);
+		CHECK(msgDecode(payloadBuff, len, decoded, scratch));
+		CHECK(decoded.size() == 9 && !decoded.containsKey("d"));
+		CHECK(scratch.size() == 9);   // positional array, no nulls in between
+		if (enc == ENC_JSONPOS) CHECK(std::string(payloadBuff, len).find("null") == std::string::npos);
+	}
+	msgEncData = ENC_JSON;
+}
+
+// The constant tables and their strings, as reported with the memory plan
+
+void testFlashTables()
+{
+	size_t tables = sizeof(alarmsP) + sizeof(siteSchema) + sizeof(tankSchema) + sizeof(msgKeys) + sizeof(cfgErrNames);
+	size_t strings = 0;
+	char name[10];
+
+	for (size_t f = 0; f < NUMSITEFIELDS; f++) strings += strlen(siteSchema[f].key) + 1;
+	for (size_t f = 0; f < NUMTANKFIELDS; f++) strings += strlen(tankSchema[f].key) + 1;
+	for (size_t k = 0; k < NUMMSGKEYS; k++) strings += strlen(msgKeys[k]) + 1;
+	strings += sizeof("missing") + sizeof("wrong type") + sizeof("out of range");
+	CHECK(flashTablesSize() == tables + strings);
+
+	CHECK(strcmp(alarmNameAt(mapAlarm(MAXDEPTH), name, sizeof(name)), "MAXDEPTH") == 0);
+	CHECK(strcmp(alarmNameAt(mapAlarm(LOALARM), name, sizeof(name)), "LO") == 0);
+	CHECK(strcmp(alarmNameAt(mapAlarm(MAXDEPTH), name, 4), "MAX") == 0);
+	CHECK(strcmp(pgmRead(cfgErrNames[CFGERR_RANGE - 1]), "out of range") == 0);
+}
+
+int main()
+{
+	testScaling();
+	testMessages();
+	testEncodings();
+	testFlashTables();
+	testPersist();
+	return(hostReport("test_memplan"));
+}
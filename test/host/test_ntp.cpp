@@ -0,0 +1,114 @@
+//
+// test_ntp.cpp
+//
+// Time service against ntpRespond() as the server: sync, drift, and every reply ntpReceive() must not take as the time
+// (not a server reply, wrong cookie, unsynchronised server, kiss-of-death, zero or garbage transmit time).
+//
+
+#include "host.h"
+
+byte req[NTP_PACKET_SIZE];
+byte resp[NTP_PACKET_SIZE];
+int requests = 0;
+
+const uint64_t serverStart = 1790000000000ULL;   // 2026-09-21
+uint64_t serverMs = serverStart;
+
+void request()
+{
+	ntpNextSync = millis();
+	ntpTick(millis());
+	CHECK(ntpPending);
+	CHECK(ntpRespond(req, NTP_PACKET_SIZE, resp, serverMs) == NTP_PACKET_SIZE);
+}
+
+// Reply doctored by f is ignored or refused, the clock is not touched
+
+void rejected(std::function<void()> f, bool stillPending)
+{
+	uint64_t before = ntpBaseEpochMs;
+
+	request();
+	f();
+	ntpReceive(resp, NTP_PACKET_SIZE, millis());
+	CHECK(ntpPending == stillPending);
+	CHECK(ntpBaseEpochMs == before);
+	ntpPending = false;
+}
+
+void setTransmit(uint32_t secs, uint32_t frac)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		resp[40 + i] = (secs >> (24 - 8 * i)) & 0xFF;
+		resp[44 + i] = (frac >> (24 - 8 * i)) & 0xFF;
+	}
+}
+
+int main()
+{
+	ntpSend = [](const byte* pkt, size_t len) { memcpy(req, pkt, len); requests++; return(true); };
+
+	// first sync, 40 ms round trip
+	request();
+	hostAdvance(40);
+	ntpReceive(resp, NTP_PACKET_SIZE, millis());
+	CHECK(ntpSynced && !ntpPending);
+	CHECK(ntpEpochMs(millis()) == serverMs + 20);
+
+	// a late duplicate of the same reply no longer matches anything outstanding
+	ntpReceive(resp, NTP_PACKET_SIZE, millis());
+	CHECK(!ntpPending);
+
+	rejected([]() { resp[0] = (resp[0] & ~0x07) | 3; }, true);            // client mode, e.g. our own request echoed
+	rejected([]() { resp[24] ^= 1; }, true);                              // someone else's originate
+	rejected([]() { memset(resp + 24, 0, 8); }, true);                    // no originate at all
+	rejected([]() { resp[0] |= 0xC0; }, false);                           // LI 3, server not synchronised
+	rejected([]() { resp[1] = 16; }, false);                              // stratum 16
+	rejected([]() { setTransmit(0, 0); }, false);                         // zero transmit time
+	rejected([]() { setTransmit(0x90000000UL, 0); }, false);              // 1976
+	rejected([]() { setTransmit(NTPEPOCHOFFSET + 1000, 0); }, false);     // 1970
+	CHECK(ntpRetries == 5);   // the refused ones count as failed attempts
+
+	// kiss-of-death: no retry until a full interval has passed
+	request();
+	resp[1] = 0;
+	memcpy(resp + 12, "RATE", 4);
+	ntpReceive(resp, NTP_PACKET_SIZE, millis());
+	CHECK(!ntpPending && ntpNextSync == millis() + ntpInterval);
+	int before = requests;
+	hostAdvance(ntpInterval - 1);
+	ntpTick(millis());
+	CHECK(requests == before);
+
+	// short packet
+	request();
+	ntpReceive(resp, NTP_PACKET_SIZE - 1, millis());
+	CHECK(ntpPending);
+	ntpReceive(resp, NTP_PACKET_SIZE, millis());
+	CHECK(!ntpPending && ntpRetries == 0);
+
+	// local clock 100 ppm fast: after an hour the drift estimate picks it up
+	uint64_t base = serverMs;
+	unsigned long baseMs = millis();
+	for (int i = 0; i < 4; i++)
+	{
+		hostAdvance(3600360);   // 3600 s of local time = 3600360 ms at +100 ppm
+		serverMs = base + (uint64_t)(millis() - baseMs) * 1000000 / 1000100;
+		request();
+		ntpReceive(resp, NTP_PACKET_SIZE, millis());
+		CHECK(ntpSynced && !ntpPending);
+	}
+	CHECK(ntpDriftKnown);
+	CHECKNEAR(ntpDriftPpm, 100, 5);
+	hostAdvance(3600000);
+	CHECKNEAR((double)(ntpEpochMs(millis()) - serverMs), 3600000 - 360, 10);
+
+	// after 2036 the seconds field wraps, era 1
+	serverMs = 2100000000000ULL;   // 2036-07-18
+	request();
+	ntpReceive(resp, NTP_PACKET_SIZE, millis());
+	CHECK(ntpBaseEpochMs == serverMs);
+
+	return(hostReport("test_ntp"));
+}
@@ -0,0 +1,104 @@
+//
+// test_persist.cpp
+//
+// Persist bank round trip: levels and sonar calibration (calA/calB, plateau in progress) survive a reboot, calTransform()
+// is rerun on load, files from before calibration was persisted still load, and the largest tank table fits the
+// buffers memPlanAllocate() sized for it.
+//
+
+#include "host.h"
+
+// Reboot: fresh tanks[] from the config on flash, then the persist bank
+
+bool reboot()
+{
+	return(loadConfig() && loadPersist());
+}
+
+void testRoundTrip()
+{
+	CHECK(hostLoadConfig(hostConfig(3)));
+
+	tanks[0].liquidDepth = 123.5F;
+	calAddPoint(0, 100, 103);
+	calAddPoint(0, 150, 154.5F);
+	CHECK(calSolve(0));
+	tanks[1].liquidDepth = 2;
+	calAddPoint(1, 50, 48);
+	CHECK(calSolve(1));
+	CHECK(!calPlateau(2, 196, 1000000UL));   // plateau starts
+
+	tank saved[3] = { tanks[0], tanks[1], tanks[2] };
+	CHECK(savePersist());
+
+	CHECK(loadConfig());
+	CHECK(tanks[0].calA == 1.0F && tanks[0].calB == 0 && tanks[2].plateauSince == 0);
+	CHECK(loadPersist());
+	for (int t = 0; t < 3; t++)
+	{
+		CHECK(tanks[t].liquidDepth == saved[t].liquidDepth);
+		CHECK(tanks[t].calA == saved[t].calA);
+		CHECK(tanks[t].calB == saved[t].calB);
+		CHECK(tanks[t].plateauLevel == saved[t].plateauLevel);
+		CHECK(tanks[t].plateauSince == saved[t].plateauSince);
+		CHECKNEAR(tanks[t].calGain, saved[t].calGain, 1e-6);
+		CHECKNEAR(tanks[t].calBias, saved[t].calBias, 1e-3);
+	}
+	CHECK(tanks[0].calA != 1.0F);
+	CHECKNEAR(calReading(0, 5000), saved[0].calGain * 5000 + saved[0].calBias, 1e-3);
+
+	// the plateau keeps counting across the reboot: 6 h after it started a correction is suggested
+	CHECK(calPlateau(2, 196.5F, 1000000UL + CALPLATEAUTIME));
+	CHECKNEAR(tanks[2].calSuggest, 4, 0.01);
+}
+
+void testOldFormat()
+{
+	CHECK(hostLoadConfig(hostConfig(2)));
+	calAddPoint(0, 100, 90);
+	CHECK(calSolve(0));
+
+	const char* old = "{\"tanklevels\":[{\"level\":12.5},{\"level\":50}]}";
+	CHECK(bankSave(TANKSMONPERSISTBANK, (const byte*)old, strlen(old)));
+	CHECK(reboot());
+	CHECK(tanks[0].liquidDepth == 12.5F && tanks[1].liquidDepth == 50);
+	CHECK(tanks[0].calA == 1.0F && tanks[0].calB == 0 && tanks[0].plateauSince == 0);
+	CHECKNEAR(tanks[0].calBias, tanks[0].depth + tanks[0].sonarOffset, 1e-3);
+
+	// missing bank: nothing applied
+	hostFiles.erase(std::string(TANKSMONPERSISTBANK) + ".a");
+	hostFiles.erase(std::string(TANKSMONPERSISTBANK) + ".b");
+	CHECK(loadConfig());
+	CHECK(!loadPersist());
+}
+
+// Every value at its longest serialized form, the full tank table
+
+void testWorstCase()
+{
+	CHECK(hostLoadConfig(hostConfig(MAXTANKS)));
+	for (int t = 0; t < numtanks; t++)
+	{
+		tanks[t].liquidDepth = -123.456789F;
+		tanks[t].calA = -1.23456789F;
+		tanks[t].calB = -123.456789F;
+		tanks[t].plateauLevel = -123.456789F;
+		tanks[t].plateauSince = 4294967295UL;
+		tanks[t].loAlarmFactor = 0.123456789F;   // set over RPC
+		tanks[t].hiAlarmFactor = 1.23456789F;
+		tanks[t].alarmSet = true;
+	}
+	CHECK(savePersist());
+	CHECK(reboot());
+	CHECK(tanks[MAXTANKS - 1].plateauSince == 4294967295UL);
+	CHECK(tanks[MAXTANKS - 1].calA == -1.23456789F);
+	CHECK(tanks[MAXTANKS - 1].alarmSet && tanks[MAXTANKS - 1].hiAlarmFactor == 1.23456789F);
+}
+
+int main()
+{
+	testRoundTrip();
+	testOldFormat();
+	testWorstCase();
+	return(hostReport("test_persist"));
+}
@@ -0,0 +1,52 @@
+//
+// test_ping.cpp
+//
+// Adaptive ping rate: first reading due at once, fast and still levels move the interval within its limits, and a
+// calibrated level below 0 (sensor bias on an empty tank) is a reading like any other.
+//
+
+#include "host.h"
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(1, "", "\"minpingdelay\":1000,\"maxpingdelay\":60000,")));
+	tank& tk = tanks[0];
+	unsigned long ms = 0;
+
+	tk.pingDelay = 8000;
+	CHECK(pingDue(0, ms));   // never read
+
+	// empty tank, calibration puts it slightly below 0: still counts as a reading
+	tk.liquidDepth = -0.4F;
+	pingUpdate(0, ms);
+	CHECK(tk.pingValid && !pingDue(0, ms + 1));
+	CHECK(pingDue(0, ms + tk.pingDelay));
+
+	// still, but near the low alarm: the delay halves
+	ms += tk.pingDelay;
+	pingUpdate(0, ms);
+	CHECK(tk.pingDelay == 4000);
+
+	// mid tank: one fast step, then still readings stretch the interval up to maxPingDelay
+	tk.liquidDepth = 100;
+	ms += tk.pingDelay;
+	pingUpdate(0, ms);
+	CHECK(tk.pingDelay == 2000);
+	for (int i = 0; i < 20; i++)
+	{
+		ms += tk.pingDelay;
+		pingUpdate(0, ms);
+	}
+	CHECK(tk.pingDelay == 60000);
+
+	// filling fast: back down to minPingDelay
+	for (int i = 0; i < 10; i++)
+	{
+		tk.liquidDepth += 10;
+		ms += tk.pingDelay;
+		pingUpdate(0, ms);
+	}
+	CHECK(tk.pingDelay == 1000);
+
+	return(hostReport("test_ping"));
+}
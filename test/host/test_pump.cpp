@@ -0,0 +1,132 @@
+//
+// test_pump.cpp
+//
+// Pump accounting on a manager: runtime and cycles from on/off events, flow from the linked tank's volume, the dry
+// run/blocked fault after PUMPCHECKTIME with next to no level change, the fault clearing, and acknowledging it over RPC.
+//
+
+#include "host.h"
+
+DynamicJsonDocument req(512);
+DynamicJsonDocument resp(1024);
+std::vector<alarmEvent> got;
+
+bool collect(const alarmEvent& ev)
+{
+	got.push_back(ev);
+	return(true);
+}
+
+// New reading of tanks[t], volume in liters
+
+void reading(int t, float volume, unsigned long ts)
+{
+	tanks[t].liquidVolume = volume;
+	aggUpdate(t);
+	pumpOnReading(t, ts);
+}
+
+bool ack(int t)
+{
+	std::string json = "{\"n\":\"mgr\",\"id\":1,\"cmd\":\"ack\",\"t\":" + std::to_string(startingTankNum + t) + "}";
+
+	CHECK(!deserializeJson(req, json));
+	return(rpcHandle(req, "mgr", resp, millis()) && (resp["r"] | -1) == RPC_OK);
+}
+
+void testRuntime(int p)
+{
+	pumpEvent(1, 1, true, 1000);
+	pumpEvent(1, 1, true, 1100);    // repeat, not a new cycle
+	CHECK(pumps[p].on && pumps[p].cycles == 1);
+	CHECK(pumpRuntime(p, 1300) == 300);
+	pumpEvent(1, 1, false, 1600);
+	pumpEvent(1, 1, false, 1700);
+	CHECK(!pumps[p].on && pumps[p].runtime == 600 && pumpRuntime(p, 5000) == 600);
+	pumpEvent(1, 1, true, 2000);
+	pumpEvent(1, 1, false, 2100);
+	CHECK(pumps[p].cycles == 2 && pumps[p].runtime == 700);
+
+	// unknown pumps and off pumps are left alone
+	pumpEvent(9, 1, true, 2200);
+	reading(0, 700, 5000);
+	CHECK(pumps[p].runtime == 700 && pumps[p].flow == 0 && !pumps[p].fault);
+}
+
+void testFault(int p)
+{
+	// 2000 L linked, the fault threshold is PUMPMINFRAC of that: 10 L per check
+	reading(0, 500, 10000);
+	pumpEvent(1, 1, true, 10000);
+	reading(0, 600, 10000 + PUMPCHECKTIME / 2);    // too early to judge
+	CHECK(pumps[p].flow == 0 && !pumps[p].fault);
+	reading(0, 800, 10000 + PUMPCHECKTIME);         // 300 L in 10 minutes
+	CHECKNEAR(pumps[p].flow, PUMPFLOWALPHA * 30, 1e-3);
+	CHECK(!pumps[p].fault && got.empty());
+
+	// dry running: 5 L in the next check
+	reading(0, 805, 10000 + 2 * PUMPCHECKTIME);
+	CHECK(pumps[p].fault && pumpFaultFlags(0) == PUMPFAULT && pumpFaultFlags(1) == 0);
+	while (alarmDispatch(millis()) > 0);
+	CHECK(got.size() == 1 && got[0].t == 0 && got[0].alarmType == PUMPFAULT && got[0].raised);
+	CHECK((tanks[0].alarmFlags & PUMPFAULT) == 0);   // kept with the pump
+
+	// flowing again clears it
+	reading(0, 900, 10000 + 3 * PUMPCHECKTIME);
+	CHECK(!pumps[p].fault && pumpFaultFlags(0) == 0);
+	while (alarmDispatch(millis()) > 0);
+	CHECK(got.size() == 2 && got[1].alarmType == PUMPFAULT && !got[1].raised);
+
+	// blocked: no change at all, cleared by switching off
+	reading(0, 900, 10000 + 4 * PUMPCHECKTIME);
+	CHECK(pumps[p].fault);
+	pumpEvent(1, 1, false, 10000 + 4 * PUMPCHECKTIME + 10);
+	CHECK(!pumps[p].fault);
+	while (alarmDispatch(millis()) > 0);
+	CHECK(got.size() == 4 && got[2].raised && !got[3].raised);
+}
+
+void testAck(int p)
+{
+	got.clear();
+	tanks[0].alarmFlags = CLEARALARMS;
+	pumpEvent(1, 1, true, 20000);
+	reading(0, 900, 20000 + PUMPCHECKTIME);
+	CHECK(pumps[p].fault);
+
+	// the ack covers the pump fault, the queued raise is dropped
+	CHECK(ack(0));
+	CHECK(tanks[0].alarmAck == PUMPFAULT && resp["aF"].as<int>() == PUMPFAULT && resp["aA"].as<int>() == PUMPFAULT);
+	while (alarmDispatch(millis()) > 0);
+	CHECK(got.empty());
+
+	// the clear is delivered and takes the ack with it, the next fault is news again
+	reading(0, 1000, 20000 + 2 * PUMPCHECKTIME);
+	CHECK(!pumps[p].fault && tanks[0].alarmAck == 0);
+	while (alarmDispatch(millis()) > 0);
+	CHECK(got.size() == 1 && !got[0].raised);
+	reading(0, 1000, 20000 + 3 * PUMPCHECKTIME);
+	while (alarmDispatch(millis()) > 0);
+	CHECK(got.size() == 2 && got[1].raised);
+	pumpEvent(1, 1, false, 20000 + 3 * PUMPCHECKTIME);
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(4)));
+	useAvg = false;
+	rpcRole = RPC_MANAGER;
+	aggInit();
+	pumpInit();
+	alarmSubscribe(collect, 0, 0);
+
+	int p = pumpFind(1, 1);
+	CHECK(numPumps == 4 && p >= 0 && pumps[p].tank == 0);
+	CHECK(pumpFind(1, 3) < 0 && pumpFaultFlags(0) == 0);
+
+	testRuntime(p);
+	testFault(p);
+	testAck(p);
+	numAlarmSinks = 0;
+	return(hostReport("test_pump"));
+}
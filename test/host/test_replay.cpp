@@ -0,0 +1,156 @@
+//
+// test_replay.cpp
+//
+// Journal replay: a journal recorded through the sharded ingest replays with no mismatches, twice with the same result,
+// without touching the live tanks, aggregates, alarm sinks or journal; a changed config, an edited record and a
+// truncated journal are reported.
+//
+
+#include "host.h"
+
+DynamicJsonDocument doc(1024);
+DynamicJsonDocument scratch(1024);
+char payload[SHARDMSGSIZE];
+std::vector<byte> journal;
+int liveAlarms = 0;
+
+void pump(unsigned long ms)
+{
+	for (int s = 0; s < NUMSHARDS; s++) shardDrain(s);
+	shardCollect();
+	for (int s = 0; s < NUMSHARDS; s++) shardCheckTimeouts(s, ms);
+	shardCollect();
+	while (alarmDispatch(ms) > 0);
+}
+
+// Four tanks wandering across their alarm levels, tank 4 goes quiet half way and times out
+
+void record()
+{
+	std::vector<tank> sensors(tanks, tanks + numtanks);
+	unsigned long ms = 0;
+
+	randomSeed(41);
+	for (auto& s : sensors) s.liquidDepth = 100;
+	for (int step = 0; step < 400; step++)
+	{
+		ms += 1000;
+		for (int t = 0; t < numtanks; t++)
+		{
+			if (t == 3 && step >= 200) continue;
+			tank& s = sensors[t];
+			s.liquidDepth = std::min(std::max(s.liquidDepth + random(-80, 81) / 10.0F, 0.0F), 210.0F);
+			s.liquidVolume = s.liquidDepth * s.vCM;
+			s.syncFull = true;
+			syncTankMsg(doc, "node1", s, startingTankNum + t);
+			size_t len = msgEncode(doc, ENC_JSON, payload, sizeof(payload), scratch);
+			CHECK(shardPush(payload, len, ms, ms / 1000));
+		}
+		pump(ms);
+	}
+	jrnFlush();
+}
+
+void countRecords(const std::vector<byte>& j, unsigned long& msgs, unsigned long& alarms, unsigned long& timeouts)
+{
+	msgs = alarms = timeouts = 0;
+	for (size_t p = 0; p + JRNHDRSIZE <= j.size();)
+	{
+		std::uint8_t type = JRNTYPE(j[p + 4]);
+		p += JRNHDRSIZE;
+		if (type == JRN_MSG) { msgs++; p += 9; }
+		if (type == JRN_ALARM) { alarms++; p += 2; }
+		if (type == JRN_TIMEOUT) timeouts++;
+	}
+}
+
+// Offset of the first record of a type
+
+size_t findRecord(const std::vector<byte>& j, std::uint8_t type)
+{
+	for (size_t p = 0; p + JRNHDRSIZE <= j.size();)
+	{
+		std::uint8_t at = JRNTYPE(j[p + 4]);
+		if (at == type) return(p);
+		p += JRNHDRSIZE + (at == JRN_MSG ? 9 : at == JRN_ALARM ? 2 : 0);
+	}
+	return(0);
+}
+
+int main()
+{
+	CHECK(hostLoadConfig(hostConfig(4)));
+	aggInit();
+	pumpInit();
+	CHECK(shardInit(numtanks));
+	jrnSink = [](const byte* b, size_t n) { journal.insert(journal.end(), b, b + n); };
+	alarmSubscribe([](const alarmEvent& ev) { liveAlarms++; return(true); }, 0, 0);
+
+	record();
+	unsigned long msgs, alarms, timeouts;
+	countRecords(journal, msgs, alarms, timeouts);
+	CHECK(msgs == 3 * 400 + 200 && alarms > 10 && timeouts == 1);
+
+	// replay matches the recording and leaves the live state alone
+	std::vector<tank> before(tanks, tanks + numtanks);
+	aggBucket siteBefore = aggSiteTotal;
+	int alarmsBefore = liveAlarms;
+	size_t journalBefore = journal.size();
+
+	jrnReplayStats st = jrnReplay(journal.data(), journal.size());
+	CHECK(st.bad == 0 && st.records == msgs + alarms + timeouts && st.msgs == msgs);
+	CHECK(st.flagMismatch == 0);
+	CHECK(st.alarms == alarms && st.alarmMismatch == 0 && st.alarmExtra == 0);
+	CHECK(st.timeouts == timeouts && st.timeoutMismatch == 0);
+
+	for (int t = 0; t < numtanks; t++)
+	{
+		CHECK(tanks[t].liquidDepth == before[t].liquidDepth);
+		CHECK(tanks[t].alarmFlags == before[t].alarmFlags);
+		CHECK(tanks[t].lastMsgTime == before[t].lastMsgTime);
+		CHECK(tanks[t].aggVolume == before[t].aggVolume);
+	}
+	CHECK(aggSiteTotal.volume == siteBefore.volume && aggSiteTotal.numTanks == siteBefore.numTanks);
+	CHECK(numAlarmSinks == 1 && liveAlarms == alarmsBefore);
+	jrnFlush();
+	CHECK(journal.size() == journalBefore && jrnSink);
+
+	// deterministic
+	jrnReplayStats again = jrnReplay(journal.data(), journal.size());
+	CHECK(again.alarms == st.alarms && again.timeouts == st.timeouts && again.records == st.records);
+
+	// alarm levels changed since the recording: flags and transitions differ
+	for (int t = 0; t < numtanks; t++) tanks[t].hiAlarm -= 30;
+	st = jrnReplay(journal.data(), journal.size());
+	CHECK(st.flagMismatch > 0 && st.alarmMismatch + st.alarmExtra > 0);
+	for (int t = 0; t < numtanks; t++) tanks[t].hiAlarm += 30;
+
+	// an edited transition is not reproduced
+	std::vector<byte> edited = journal;
+	size_t a = findRecord(edited, JRN_ALARM);
+	edited[a + JRNHDRSIZE + 1] ^= 1;
+	st = jrnReplay(edited.data(), edited.size());
+	CHECK(st.alarmMismatch == 1 && st.alarmExtra == 1);
+
+	// truncated, unknown tank, older record format
+	st = jrnReplay(journal.data(), journal.size() - 3);
+	CHECK(st.bad == 1);
+	edited = journal;
+	edited[5] = 200;
+	st = jrnReplay(edited.data(), edited.size());
+	CHECK(st.bad == 1 && st.records == 0);
+	edited = journal;
+	edited[4] = JRNTYPE(edited[4]);
+	st = jrnReplay(edited.data(), edited.size());
+	CHECK(st.bad == 1 && st.records == 0);
+
+	// tank indexes past 255 are kept whole, past 16 bits they are not journalled
+	journal.clear();
+	CHECK(jrnBegin(JRN_TIMEOUT, 300, 1000) && !jrnBegin(JRN_TIMEOUT, JRNMAXTANK + 1, 1000) && !jrnBegin(JRN_TIMEOUT, -1, 1000));
+	jrnFlush();
+	CHECK(journal.size() == JRNHDRSIZE && JRNTYPE(journal[4]) == JRN_TIMEOUT && (journal[4] >> 4) == JRNFORMAT);
+	CHECK((journal[5] | (journal[6] << 8)) == 300);
+
+	jrnSink = nullptr;
+	return(hostReport("test_replay"));
+}
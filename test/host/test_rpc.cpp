@@ -0,0 +1,178 @@
+//
+// test_rpc.cpp
+//
+// Control topic RPC in both roles. A sensor node answers get/hist/ping/set, a set survives a reboot; a manager answers
+// get/hist/ack from its copy, forwards set to the node it heard the tank from and pulls the new static fields even if
+// the sensor's full message never arrives. Messages that are not requests for this node are ignored.
+//
+
+#include "host.h"
+
+DynamicJsonDocument req(512);
+DynamicJsonDocument resp(2048);
+DynamicJsonDocument doc(1024);
+DynamicJsonDocument scratch(1024);
+char payload[SHARDMSGSIZE];
+std::vector<std::pair<std::string, int>> pulls;
+
+bool call(const char* node, const std::string& json, unsigned long ms = 0)
+{
+	CHECK(!deserializeJson(req, json));
+	return(rpcHandle(req, node, resp, ms));
+}
+
+int result()
+{
+	return(resp["r"] | -1);
+}
+
+void testSensor()
+{
+	CHECK(hostLoadConfig(hostConfig(2)));
+	rpcRole = RPC_SENSOR;
+
+	// not requests for us
+	CHECK(!call("node1", "{\"n\":\"node2\",\"id\":1,\"cmd\":\"get\",\"t\":1}"));
+	CHECK(!call("node1", "{\"n\":\"node1\",\"cmd\":\"get\",\"t\":1}"));          // no id
+	CHECK(!call("node1", "{\"n\":\"node1\",\"id\":1,\"c\":\"get\",\"t\":1}"));   // old key
+	CHECK(!call("node1", "{\"n\":\"node1\",\"id\":1,\"r\":0}"));                 // a response
+	CHECK(!call("node1", "{\"n\":\"node1\",\"cmd\":\"sync\",\"t\":1}"));         // a pull
+
+	tanks[1].liquidDepth = 42;
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":7,\"cmd\":\"get\",\"t\":2}"));
+	CHECK(result() == RPC_OK && resp["id"].as<int>() == 7 && resp["t"].as<int>() == 2 && resp["lD"].as<float>() == 42.0F);
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":8,\"cmd\":\"get\",\"t\":3}") && result() == RPC_BADTANK);
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":9,\"cmd\":\"ack\",\"t\":1}") && result() == RPC_BADREQ);   // manager only
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":9,\"cmd\":\"nope\",\"t\":1}") && result() == RPC_BADREQ);
+
+	// history range
+	for (uint32_t ts = 100; ts <= 500; ts += 100)
+	{
+		tanks[0].liquidDepth = ts / 10.0F;
+		histAdd(0, ts);
+	}
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":10,\"cmd\":\"hist\",\"t\":1,\"f\":200,\"to\":400}"));
+	CHECK(result() == RPC_OK && resp["h"].size() == 3 && resp["h"][0][0].as<int>() == 200 && resp["h"][2][1].as<float>() == 40.0F);
+
+	// forced pings: deferred, bounded, answered by the next reading or timed out
+	int pinged = 0;
+	rpcPingHook = [&](int t) { pinged++; };
+	for (int i = 0; i < RPCMAXPENDING; i++)
+		CHECK(!call("node1", "{\"n\":\"node1\",\"id\":" + std::to_string(20 + i) + ",\"cmd\":\"ping\",\"t\":" + std::to_string(1 + i % 2) + "}", 1000));
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":30,\"cmd\":\"ping\",\"t\":1}", 1000) && result() == RPC_BUSY);
+	CHECK(pinged == RPCMAXPENDING);
+	CHECK(!rpcPoll(resp, "node1", 2000));
+	rpcOnReading(0);
+	int answered = 0;
+	while (rpcPoll(resp, "node1", 2000)) answered++;
+	CHECK(answered == RPCMAXPENDING / 2 && result() == RPC_OK && resp["t"].as<int>() == 1);
+	CHECK(rpcPoll(resp, "node1", 1000 + RPCTIMEOUT + 1) && result() == RPC_TIMEOUT);
+	while (rpcPoll(resp, "node1", 1000 + RPCTIMEOUT + 1));
+	rpcPingHook = nullptr;
+
+	// set: applied, sent with the next message and kept over the config across a reboot
+	tanks[0].syncFull = false;
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":40,\"cmd\":\"set\",\"t\":1,\"lo\":0.2,\"hi\":0.9}"));
+	CHECK(result() == RPC_OK && tanks[0].syncFull && tanks[0].alarmSet);
+	CHECKNEAR(tanks[0].loAlarm, 0.2 * tanks[0].depth, 1e-3);
+	CHECKNEAR(resp["hiA"].as<float>(), 0.9 * tanks[0].depth, 1e-3);
+	CHECK(call("node1", "{\"n\":\"node1\",\"id\":41,\"cmd\":\"set\",\"t\":2,\"lo\":0.9,\"hi\":0.2}") && result() == RPC_BADREQ);
+	CHECK(!tanks[1].alarmSet);
+
+	CHECK(loadConfig());
+	CHECKNEAR(tanks[0].loAlarmFactor, 0.10, 1e-6);
+	CHECK(loadPersist());
+	CHECKNEAR(tanks[0].loAlarmFactor, 0.2, 1e-6);
+	CHECKNEAR(tanks[0].hiAlarm, 0.9 * tanks[0].depth, 1e-3);
+	CHECKNEAR(tanks[1].hiAlarmFactor, 1.10, 1e-6);
+	CHECK(tanks[0].alarmSet && !tanks[1].alarmSet);
+}
+
+size_t sensorMsg(tank& sensor, int tankNum)
+{
+	syncTankMsg(doc, "node1", sensor, tankNum);
+	return(msgEncode(doc, ENC_JSON, payload, sizeof(payload), scratch));
+}
+
+void pump(unsigned long ms)
+{
+	for (int s = 0; s < NUMSHARDS; s++) shardDrain(s);
+	shardCollect();
+}
+
+void testManager()
+{
+	CHECK(hostLoadConfig(hostConfig(2)));
+	aggInit();
+	pumpInit();
+	CHECK(shardInit(numtanks));
+	shardPullHook = [](const char* node, int tankNum) { pulls.push_back(std::make_pair(std::string(node), tankNum)); };
+	rpcRole = RPC_MANAGER;
+
+	// nothing heard from tank 1 yet: no node to forward to
+	CHECK(call("mgr", "{\"n\":\"mgr\",\"id\":1,\"cmd\":\"set\",\"t\":1,\"lo\":0.2}") && result() == RPC_NOROUTE);
+
+	tank sensor = tanks[0];
+	sensor.liquidDepth = 10;
+	sensor.liquidVolume = 100;
+	sensor.syncFull = true;
+	size_t len = sensorMsg(sensor, 1);
+	CHECK(shardPush(payload, len, 1000, 3600));
+	pump(1000);
+	CHECK(strcmp(tanks[0].node, "node1") == 0 && tanks[0].alarmFlags == LOALARM);
+
+	// get, hist and ack are answered by the manager, ping is not
+	CHECK(call("mgr", "{\"n\":\"mgr\",\"id\":2,\"cmd\":\"get\",\"t\":1}") && result() == RPC_OK && resp["lD"].as<float>() == 10.0F);
+	CHECK(call("mgr", "{\"n\":\"mgr\",\"id\":3,\"cmd\":\"hist\",\"t\":1}") && resp["h"].size() == 1);
+	CHECK(call("mgr", "{\"n\":\"mgr\",\"id\":4,\"cmd\":\"ack\",\"t\":1}") && result() == RPC_OK);
+	CHECK(tanks[0].alarmAck == LOALARM && resp["aA"].as<int>() == LOALARM);
+	CHECK(call("mgr", "{\"n\":\"mgr\",\"id\":5,\"cmd\":\"ping\",\"t\":1}") && result() == RPC_BADREQ);
+
+	// set is readdressed to node1 under the same id
+	CHECK(call("mgr", "{\"n\":\"mgr\",\"id\":6,\"cmd\":\"set\",\"t\":1,\"lo\":0.2,\"hi\":0.9}"));
+	CHECK(strcmp(resp["n"] | "", "node1") == 0 && resp["id"].as<int>() == 6 && strcmp(resp["cmd"] | "", "set") == 0);
+	CHECK(resp["t"].as<int>() == 1 && resp["lo"].as<float>() == 0.2F && resp["hi"].as<float>() == 0.9F && !resp.containsKey("r"));
+	CHECK(tanks[0].cfgHash == 0);
+
+	// the sensor's full message with the new levels is lost, its next delta (new hash) is pulled
+	std::string fwd;
+	serializeJson(resp, fwd);
+	rpcRole = RPC_SENSOR;
+	tank* mgrTanks = tanks;
+	tank node1[1] = { sensor };
+	tanks = node1;
+	numtanks = 1;
+	CHECK(call("node1", fwd) && result() == RPC_OK && tanks[0].syncFull);
+	sensor = tanks[0];
+	tanks = mgrTanks;
+	numtanks = 2;
+	rpcRole = RPC_MANAGER;
+	sensorMsg(sensor, 1);   // the full message, lost
+	len = sensorMsg(sensor, 1);
+	CHECK(shardPush(payload, len, 2000, 3700));
+	pump(2000);
+	CHECK(pulls.size() == 1 && pulls[0].first == "node1" && pulls[0].second == 1);
+
+	sensor.syncFull = true;
+	len = sensorMsg(sensor, 1);
+	CHECK(shardPush(payload, len, 3000, 3800));
+	pump(3000);
+	CHECKNEAR(tanks[0].hiAlarm, 0.9 * sensor.depth, 1e-3);
+	CHECK(tanks[0].cfgHash == syncHash(sensor));
+
+	// a shard that has not caught up refuses further resyncs, the manager copy is still cleared
+	for (int i = 0; i < SHARDQUEUESIZE; i++) CHECK(shardResync(1));
+	tanks[1].cfgHash = 1;
+	CHECK(!shardResync(1) && tanks[1].cfgHash == 0);
+	pump(4000);
+	CHECK(shardResync(1));
+	shardPullHook = nullptr;
+	rpcRole = RPC_SENSOR;
+}
+
+int main()
+{
+	testSensor();
+	testManager();
+	return(hostReport("test_rpc"));
+}
@@ -0,0 +1,229 @@
+//
+// test_shard.cpp
+//
+// Sharded ingest: a reading pushed as a raw message must come out of shardCollect() having gone through the whole
+// pipeline (sync, alarms, aggregates, forecast, history, journal, RPC), in every encoding; timeouts, pulls, back
+// pressure, gateway registration, and a threaded run with one worker per shard.
+//
+
+#include "host.h"
+#include <thread>
+
+DynamicJsonDocument doc(1024);
+DynamicJsonDocument scratch(1024);
+char payload[SHARDMSGSIZE];
+std::vector<alarmEvent> events;
+std::vector<std::pair<std::string, int>> pulls;
+std::vector<byte> journal;
+
+// Sensor side copy of a tank, encoded the way the node would send it
+
+size_t sensorMsg(tank& sensor, int tankNum, int enc = ENC_JSON)
+{
+	syncTankMsg(doc, "node1", sensor, tankNum);
+	return(msgEncode(doc, enc, payload, sizeof(payload), scratch));
+}
+
+void pump(unsigned long ms = 1000)
+{
+	for (int s = 0; s < NUMSHARDS; s++) shardDrain(s);
+	shardCollect();
+	alarmDispatch(ms);
+}
+
+void testPipeline()
+{
+	CHECK(hostLoadConfig(hostConfig(4)));
+	aggInit();
+	pumpInit();
+	CHECK(shardInit(numtanks));
+	jrnSink = [](const byte* b, size_t n) { journal.insert(journal.end(), b, b + n); };
+	alarmSubscribe([](const alarmEvent& ev) { events.push_back(ev); return(true); }, 0, 0);
+	shardPullHook = [](const char* node, int tankNum) { pulls.push_back(std::make_pair(std::string(node), tankNum)); };
+
+	tank sensor = tanks[0];
+	sensor.liquidDepth = 100;
+	sensor.liquidVolume = 1000;
+	sensor.syncFull = true;
+
+	// peek works for every encoding
+	for (int enc = ENC_JSON; enc <= ENC_MSGPACK; enc++)
+	{
+		size_t len = sensorMsg(sensor, 3, enc);
+		CHECK(shardPeekTank(payload, len) == 3);
+		sensor.syncFull = true;
+		len = sensorMsg(sensor, 200, enc);
+		CHECK(shardPeekTank(payload, len) == 200);
+	}
+	CHECK(shardPeekTank("{\"n\":\"x\"}", 9) == -1);
+	CHECK(shardPeekTank("[\"a,\\\"b\",7]", 11) == 7);
+
+	// full message for tank 1 (t = 0)
+	sensor.syncFull = true;
+	size_t len = sensorMsg(sensor, 1);
+	CHECK(shardPush(payload, len, 1000, 3600));
+	CHECK(tanks[0].liquidDepth == 0);   // nothing published until collected
+	pump();
+	CHECK(tanks[0].liquidDepth == 100);
+	CHECK(tanks[0].cfgHash == syncHash(sensor));
+	CHECK(tanks[0].alarmFlags == CLEARALARMS);
+	CHECK(aggSiteTotal.volume == 10000);
+	CHECK(histCount[0] == 1 && histAt(0, 0).level == 100);
+	CHECK(tanks[0].fcTime == 3600);
+	CHECK(pulls.empty());
+
+	// delta below the low alarm level: flagged by the manager even though the sensor says clear
+	sensor.liquidDepth = 10;
+	sensor.liquidVolume = 100;
+	sensor.alarmFlags = CLEARALARMS;
+	rpcPend[0] = { true, false, 5, 0, 1000 };
+	len = sensorMsg(sensor, 1, ENC_MSGPACK);
+	CHECK(shardPush(payload, len, 2000, 7200));
+	pump(2000);
+	CHECK(tanks[0].liquidDepth == 10);
+	CHECK(tanks[0].alarmFlags == LOALARM);
+	CHECK(aggSiteTotal.alarmCount[mapAlarm(LOALARM)] == 1);
+	CHECK(events.size() == 1 && events[0].t == 0 && events[0].alarmType == LOALARM && events[0].raised);
+	CHECK(rpcPend[0].done);
+	rpcPend[0] = rpcPending();
+	CHECK(shards[0].alarmFlag && shardAnyAlarm());
+	jrnFlush();
+	CHECK(journal.size() == 2 * (JRNHDRSIZE + 9) + JRNHDRSIZE + 2);   // two readings and the alarm
+
+	// static fields changed on the sensor without a full message: pull
+	sensor.loAlarm = 30;
+	len = sensorMsg(sensor, 1, ENC_JSONPOS);
+	CHECK(shardPush(payload, len, 3000, 10800));
+	pump(3000);
+	CHECK(pulls.size() == 1 && pulls[0].first == "node1" && pulls[0].second == 1);
+
+	// garbage and unknown tank numbers are counted, not applied
+	CHECK(!shardPush("{\"t\":99}", 8, 0, 0));
+	CHECK(shardPush("{\"t\":2,", 7, 0, 0));
+	pump();
+	CHECK(shards[1].rejected == 1);
+
+	// timeouts are journalled once per transition
+	jrnFlush();
+	journal.clear();
+	int timedOut = 0;
+	for (int s = 0; s < NUMSHARDS; s++) timedOut += shardCheckTimeouts(s, 3000 + tanks[0].timeOut + 1);
+	CHECK(timedOut == 4);   // tanks 1..3 never reported, count as timed out
+	shardCollect();
+	for (int s = 0; s < NUMSHARDS; s++) shardCheckTimeouts(s, 3000 + tanks[0].timeOut + 2);
+	shardCollect();
+	jrnFlush();
+	CHECK(journal.size() == JRNHDRSIZE && JRNTYPE(journal[4]) == JRN_TIMEOUT && journal[5] == 0 && journal[6] == 0);
+	jrnSink = nullptr;
+}
+
+void testBackPressure()
+{
+	tank sensor = tanks[0];
+	size_t len;
+	int accepted = 0;
+
+	sensor.syncFull = true;
+	len = sensorMsg(sensor, 1);
+	for (int i = 0; i < 2 * SHARDQUEUESIZE + 1; i++)
+		if (shardPush(payload, len, 5000 + i, 20000)) accepted++;
+	CHECK(accepted == SHARDQUEUESIZE);
+
+	CHECK(shardDrain(0) == SHARDQUEUESIZE);   // fills the out queue
+	for (int i = 0; i < SHARDQUEUESIZE; i++) CHECK(shardPush(payload, len, 6000 + i, 20000));
+	CHECK(shardDrain(0) == 0);   // out queue full, nothing lost
+	CHECK(shardCollect() == SHARDQUEUESIZE);
+	CHECK(shardDrain(0) == SHARDQUEUESIZE);
+	CHECK(shardCollect() == SHARDQUEUESIZE);
+	CHECK(tanks[0].lastMsgTime == 6000 + SHARDQUEUESIZE - 1);
+}
+
+void testGateway()
+{
+	int known = aggSiteTotal.numTanks;
+	tank sensor = tanks[0];
+
+	CHECK(shardInit(1000));
+	CHECK(numtanks == 1000 && tanks[999].ignore && tanks[999].depth == 0);
+	CHECK(tanks[0].liquidDepth != 0);   // configured tanks kept
+
+	// delta from an unknown tank: pull, nothing registered
+	pulls.clear();
+	sensor.syncFull = false;
+	size_t len = sensorMsg(sensor, 500);
+	CHECK(shardPush(payload, len, 7000, 30000));
+	pump();
+	CHECK(pulls.size() == 1 && pulls[0].second == 500);
+	CHECK(tanks[499].ignore);
+
+	// its full message registers it, type included
+	sensor.syncFull = true;
+	sensor.liquidDepth = 150;
+	sensor.liquidVolume = 1500;
+	sensor.tankType = "p";
+	len = sensorMsg(sensor, 500);
+	CHECK(shardPush(payload, len, 8000, 31000));
+	pump();
+	CHECK(!tanks[499].ignore && tanks[499].depth == sensor.depth && tanks[499].liquidDepth == 150);
+	CHECK(strcmp(tanks[499].tankType, "P") == 0);
+	CHECK(aggSiteTotal.numTanks == known + 1);
+	CHECK(aggFindType('P', false) != nullptr && aggFindType('P', false)->numTanks == 1);
+	CHECKNEAR(aggVolume(aggFindType('P', false)), 1500, 1e-3);
+
+	// a configured tank keeps its configured type
+	sensor.syncFull = true;
+	len = sensorMsg(sensor, startingTankNum + 1);
+	CHECK(shardPush(payload, len, 9000, 32000));
+	pump();
+	CHECK(strcmp(tanks[1].tankType, "W") == 0);
+}
+
+// One worker thread per shard, producer and collector on this thread
+
+void testThreads()
+{
+	const int numMsgs = 20000;
+	std::atomic<bool> stop{ false };
+	std::vector<std::thread> workers;
+	std::vector<float> last(numtanks, -1);
+	std::vector<std::string> msgs;
+	std::vector<int> msgTank;
+	tank sensor = tanks[0];
+	int collected = 0;
+
+	for (int i = 0; i < numMsgs; i++)
+	{
+		int t = random(64);
+		sensor.syncFull = true;
+		sensor.liquidDepth = random(1, 200);
+		size_t len = sensorMsg(sensor, startingTankNum + t, i % 3);
+		msgs.push_back(std::string(payload, len));
+		msgTank.push_back(t);
+		last[t] = sensor.liquidDepth;
+	}
+
+	for (int s = 0; s < NUMSHARDS; s++)
+		workers.push_back(std::thread([s, &stop]() { while (!stop) if (shardDrain(s) == 0) std::this_thread::yield(); }));
+
+	for (int i = 0; i < numMsgs; )
+	{
+		if (shardPush(msgs[i].data(), msgs[i].size(), 9000, 40000)) i++;
+		else collected += shardCollect();
+	}
+	while (collected < numMsgs) collected += shardCollect();
+	stop = true;
+	for (auto& w : workers) w.join();
+
+	CHECK(collected == numMsgs);
+	for (int t = 0; t < 64; t++)
+		if (last[t] >= 0) CHECK(tanks[t].liquidDepth == last[t]);
+}
+
+int main()
+{
+	testPipeline();
+	testBackPressure();
+	testGateway();
+	testThreads();
+	return(hostReport("test_shard"));
+}